@@ -6,11 +6,26 @@ LOCAL_SRC_FILES := \
     src/ctlr_mgr.cpp \
     src/epoll_mgr.cpp \
     src/epoll_subscriber.cpp \
+    src/ff_effect_table.cpp \
+    src/ff_pipeline.cpp \
+    src/fuzz_tuner.cpp \
+    src/latency_histogram.cpp \
+    src/metrics.cpp \
+    src/metrics_server.cpp \
+    src/uinput_frame.cpp \
     src/phys_ctlr.cpp \
+    src/pm_qos.cpp \
+    src/realtime.cpp \
+    src/remap_profiles.cpp \
+    src/rumble_scheduler.cpp \
+    src/state_export.cpp \
+    src/sysfs_led.cpp \
+    src/timer_wheel.cpp \
     src/virt_ctlr.cpp \
     src/virt_ctlr_combined.cpp \
     src/virt_ctlr_passthrough.cpp \
     src/virt_ctlr_pro.cpp \
+    src/worker_thread.cpp \
     src/main.cpp
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
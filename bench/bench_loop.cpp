@@ -0,0 +1,108 @@
+// Relays input from a uinput loopback device through a virtual pro controller on each event loop
+// backend, and reports the loop's wakeups and system calls per relayed frame.
+#include "loopback.h"
+#include "phys_ctlr.h"
+#include "virt_ctlr_pro.h"
+#include "worker_thread.h"
+
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <thread>
+#include <time.h>
+
+static const unsigned int FRAMES = 10000;
+// Roughly a controller reporting at full rate, with the odd pair arriving together
+static const long FRAME_INTERVAL_NS = 500000;
+static const unsigned int BURST_EVERY = 8;
+
+// The value of a sample in metrics_writer output
+static double sample(std::string const &text, std::string const &name)
+{
+    std::istringstream lines(text);
+    std::string line;
+
+    while (std::getline(lines, line)) {
+        if (line.compare(0, name.size(), name) == 0 && line.size() > name.size() && line[name.size()] == '{')
+            return strtod(line.c_str() + line.rfind(' ') + 1, nullptr);
+    }
+    return 0;
+}
+
+static uint64_t thread_cpu_ns()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+static void bench(loopback &device, enum epoll_mgr::Backend backend, char const *name)
+{
+    joycond_config config;
+    metrics_registry metrics;
+    epoll_mgr epoll_manager(backend);
+    worker_thread ff_worker("ff", -1, metrics);
+    remap_profiles remaps;
+
+    auto phys = std::make_shared<phys_ctlr>(device.get_devpath(), device.get_devname(), epoll_manager, config,
+                                            metrics);
+    phys->set_event_mask(phys_ctlr::EventMask::Relay);
+    virt_ctlr_pro procon(phys, epoll_manager, ff_worker, remaps, config, metrics);
+    // Subscribed the way ctlr_mgr subscribes a paired controller
+    auto sub = std::make_shared<epoll_subscriber>(std::vector({phys->get_fd()}),
+                                                  [&](int event_fd){procon.handle_events(event_fd);},
+                                                  "relay");
+    sub->set_relay(true);
+    epoll_manager.add_subscriber(sub);
+
+    // Nothing written before this point counts
+    std::string labels = metrics_writer::label("loop", name);
+    metrics_writer before;
+    epoll_manager.write_metrics(before, labels);
+    uint64_t events_before = phys->get_read_stats().events.get();
+    uint64_t cpu_before = thread_cpu_ns();
+
+    std::thread writer([&](){
+        struct timespec interval = { 0, FRAME_INTERVAL_NS };
+        for (unsigned int i = 0; i < FRAMES; i++) {
+            device.write_frame(i % 2 ? 100 : -100, i % 2);
+            if (i % BURST_EVERY)
+                nanosleep(&interval, nullptr);
+        }
+    });
+    while (phys->get_read_stats().events.get() - events_before < FRAMES * loopback::EVENTS_PER_FRAME)
+        epoll_manager.loop();
+    uint64_t cpu_ns = thread_cpu_ns() - cpu_before;
+    writer.join();
+
+    metrics_writer after;
+    epoll_manager.write_metrics(after, labels);
+    double wakeups = sample(after.str(), "joycond_epoll_wakeups_total") -
+                     sample(before.str(), "joycond_epoll_wakeups_total");
+    double syscalls = sample(after.str(), "joycond_loop_syscalls_total") -
+                      sample(before.str(), "joycond_loop_syscalls_total");
+
+    std::cout << name << ":\n"
+              << "  wakeups per frame:   " << wakeups / FRAMES << "\n"
+              << "  syscalls per frame:  " << syscalls / FRAMES << "\n"
+              << "  loop cpu per frame:  " << cpu_ns / FRAMES << " ns" << std::endl;
+
+    epoll_manager.remove_subscriber(sub);
+}
+
+int main(int argc, char *argv[])
+{
+    loopback device;
+
+    bench(device, epoll_mgr::Backend::Epoll, "epoll");
+#ifdef HAVE_IO_URING
+    bench(device, epoll_mgr::Backend::Io_Uring, "io_uring");
+#else
+    std::cout << "io_uring: not built, configure with -DJOYCOND_IO_URING=ON" << std::endl;
+#endif
+    return EXIT_SUCCESS;
+}
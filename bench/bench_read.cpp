@@ -0,0 +1,92 @@
+// Reads the same input through phys_ctlr::next_event() with libevdev and with --raw-read, and
+// checks that both end up with the controller's real state after the kernel dropped events.
+#include "loopback.h"
+#include "phys_ctlr.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <time.h>
+
+static const unsigned int FRAMES = 200000;
+// Frames written before each drain, like reports piling up between two wakeups
+static const unsigned int BATCH = 8;
+// Far more than the kernel queues for a client, so the queue overflows
+static const unsigned int FLOOD_FRAMES = 1000;
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Reads until nothing is left and applies what was read to x and button
+static unsigned int drain(phys_ctlr &phys, int &x, int &button)
+{
+    struct input_event ev;
+    unsigned int count = 0;
+
+    while (phys.next_event(ev) >= 0) {
+        if (ev.type == EV_ABS && ev.code == ABS_X)
+            x = ev.value;
+        else if (ev.type == EV_KEY && ev.code == BTN_SOUTH)
+            button = ev.value;
+        count++;
+    }
+    return count;
+}
+
+static bool bench(loopback &device, bool raw_read)
+{
+    joycond_config config;
+    epoll_mgr epoll_manager;
+    metrics_registry metrics;
+    int x = 0;
+    int button = 0;
+
+    config.raw_read = raw_read;
+    phys_ctlr phys(device.get_devpath(), device.get_devname(), epoll_manager, config, metrics);
+    drain(phys, x, button);
+
+    uint64_t events = 0;
+    uint64_t ns = 0;
+    for (unsigned int i = 0; i < FRAMES; i += BATCH) {
+        for (unsigned int j = i; j < i + BATCH; j++)
+            device.write_frame(j % 2 ? 100 : -100, j % 2);
+        uint64_t start_ns = now_ns();
+        events += drain(phys, x, button);
+        ns += now_ns() - start_ns;
+    }
+    uint64_t reads = phys.get_read_stats().reads.get();
+
+    // Leave the stick and button somewhere, then overflow the queue while putting them back
+    device.write_frame(1000, true);
+    drain(phys, x, button);
+    for (unsigned int i = 0; i < FLOOD_FRAMES; i++)
+        device.write_frame(i % 2 ? 500 : -500, i % 2);
+    device.write_frame(0, false);
+    drain(phys, x, button);
+    uint64_t resyncs = phys.get_read_stats().resyncs.get();
+    bool synced = x == 0 && button == 0;
+
+    std::cout << (raw_read ? "raw read:" : "libevdev:") << "\n"
+              << "  events:        " << events << " of " << FRAMES * loopback::EVENTS_PER_FRAME << " written\n"
+              << "  ns per event:  " << (events ? ns / events : 0) << "\n";
+    // libevdev reads on its own, so only the raw path counts its read() calls
+    if (raw_read)
+        std::cout << "  reads:         " << reads << " (" << (double)reads / (FRAMES / BATCH) << " per drain)\n";
+    std::cout << "  after SYN_DROPPED: " << resyncs << " resyncs, ABS_X=" << x << " BTN_SOUTH=" << button
+              << (synced ? " (ok)" : " (stale, expected ABS_X=0 BTN_SOUTH=0)") << std::endl;
+    return resyncs && synced;
+}
+
+int main(int argc, char *argv[])
+{
+    loopback device;
+    bool ok = true;
+
+    for (bool raw_read : { false, true })
+        ok &= bench(device, raw_read);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,62 @@
+#include "loopback.h"
+
+#include <cstring>
+#include <iostream>
+#include <libevdev/libevdev.h>
+#include <linux/input.h>
+#include <stdlib.h>
+
+//public
+loopback::loopback() :
+    uidev(nullptr)
+{
+    struct libevdev *dev = libevdev_new();
+    struct input_absinfo absinfo = { 0, -32767, 32767, 0, 0, 0 };
+
+    libevdev_set_name(dev, "joycond bench controller");
+    libevdev_set_id_bustype(dev, BUS_VIRTUAL);
+    libevdev_set_id_vendor(dev, 0x057e);
+    libevdev_set_id_product(dev, 0x2009);
+    libevdev_enable_event_code(dev, EV_KEY, BTN_SOUTH, nullptr);
+    for (unsigned int code : { ABS_X, ABS_Y, ABS_RX, ABS_RY })
+        libevdev_enable_event_code(dev, EV_ABS, code, &absinfo);
+
+    int ret = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
+    libevdev_free(dev);
+    if (ret) {
+        std::cerr << "Failed to create uinput device; " << strerror(-ret) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+loopback::~loopback()
+{
+    libevdev_uinput_destroy(uidev);
+}
+
+std::string loopback::get_devpath()
+{
+    // syspath is /sys/devices/.../inputN, the event node sits below it
+    std::string syspath = libevdev_uinput_get_syspath(uidev);
+    std::string devname = get_devname();
+
+    return syspath.substr(strlen("/sys")) + devname.substr(devname.rfind('/'));
+}
+
+std::string loopback::get_devname()
+{
+    char const *devnode = libevdev_uinput_get_devnode(uidev);
+
+    if (!devnode) {
+        std::cerr << "uinput device has no event node\n";
+        exit(EXIT_FAILURE);
+    }
+    return devnode;
+}
+
+void loopback::write_frame(int x, bool button)
+{
+    libevdev_uinput_write_event(uidev, EV_ABS, ABS_X, x);
+    libevdev_uinput_write_event(uidev, EV_KEY, BTN_SOUTH, button);
+    libevdev_uinput_write_event(uidev, EV_SYN, SYN_REPORT, 0);
+}
@@ -0,0 +1,29 @@
+#ifndef JOYCOND_BENCH_LOOPBACK_H
+#define JOYCOND_BENCH_LOOPBACK_H
+
+#include <libevdev/libevdev-uinput.h>
+#include <string>
+
+// A uinput device that looks enough like a Pro Controller for phys_ctlr to take it, so that a
+// benchmark can feed input through the same paths as a real controller. Needs write access to
+// /dev/uinput.
+class loopback
+{
+    public:
+        // Each frame moves ABS_X and toggles BTN_SOUTH, then SYN_REPORT
+        static const unsigned int EVENTS_PER_FRAME = 3;
+
+    private:
+        struct libevdev_uinput *uidev;
+
+    public:
+        loopback();
+        ~loopback();
+
+        // As ctlr_detector_udev hands them to ctlr_mgr
+        std::string get_devpath();
+        std::string get_devname();
+        void write_frame(int x, bool button);
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include "ctlr_mgr.h"
 #include "epoll_mgr.h"
 
+#include <deque>
+
 class ctlr_detector_android
 {
     private:
@@ -13,10 +15,14 @@ class ctlr_detector_android
 
         std::map<std::string, std::string> ctlr_dev_map;
         std::map<std::string, std::string> ctlr_mac_map;
+        std::deque<epoll_mgr::timer_id> pending_uevents;
+
+        static const uint64_t UEVENT_SETTLE_NS = 100000000;
 
         bool check_ctlr_attributes(std::string devpath);
         void scan_removed_ctlrs();
         void epoll_event_callback(int event_fd);
+        void handle_uevent(bool action, std::string devpath, std::string devnode);
     public:
         ctlr_detector_android(ctlr_mgr& ctlr_manager, epoll_mgr& epoll_manager );
         ~ctlr_detector_android();
@@ -14,8 +14,12 @@ class ctlr_detector_udev
         struct udev *udev;
         struct udev_monitor *mon;
         int udev_mon_fd;
+        // LED class devices, which hid-nintendo registers after the input device
+        std::shared_ptr<epoll_subscriber> led_subscriber;
+        struct udev_monitor *led_mon;
 
         void epoll_event_callback(int event_fd);
+        void led_event_callback(int event_fd);
 
     public:
         ctlr_detector_udev(ctlr_mgr& ctlr_manager, epoll_mgr& epoll_manager );
@@ -1,38 +1,93 @@
 #ifndef JOYCOND_CTLR_MANAGER_H
 #define JOYCOND_CTLR_MANAGER_H
 
+#include <functional>
 #include <string>
 #include <map>
 #include <memory>
 #include <vector>
 
 #include "epoll_mgr.h"
+#include "joycond_config.h"
+#include "metrics.h"
 #include "phys_ctlr.h"
+#include "pm_qos.h"
+#include "remap_profiles.h"
+#include "spsc_queue.h"
 #include "virt_ctlr.h"
+#include "worker_thread.h"
 
 class ctlr_mgr
 {
     private:
         epoll_mgr& epoll_manager;
+        // Runs the detectors, builds phys_ctlrs and does every LED write
+        worker_thread& control;
+        const joycond_config& config;
+        metrics_registry& metrics;
+        // Relay threads, and which of them runs each virtual controller; empty runs everything here
+        std::vector<std::unique_ptr<worker_thread>> workers;
+        std::map<const virt_ctlr *, worker_thread *> owners;
+        // Force feedback uploads and erases, which can take milliseconds over Bluetooth
+        worker_thread ff_worker;
+        pm_qos cpu_latency;
+        remap_profiles remaps;
         std::map<std::string, std::shared_ptr<phys_ctlr>> unpaired_controllers;
-        std::map<std::string, std::shared_ptr<epoll_subscriber>> subscribers;
+
+        struct phys_subscription {
+            worker_thread *worker;
+            std::shared_ptr<epoll_subscriber> subscriber;
+        };
+        std::map<std::string, struct phys_subscription> subscribers;
         std::vector<std::unique_ptr<virt_ctlr>> paired_controllers;
         std::vector<std::unique_ptr<virt_ctlr>> stale_controllers;
 
         std::shared_ptr<phys_ctlr> left;
         std::shared_ptr<phys_ctlr> right;
 
-        void epoll_event_callback(int event_fd);
+        // Devices the control thread has handed over; only touched on the control thread, which is
+        // also where phys_ctlrs are deleted, so the weak pointers can't dangle while it looks
+        std::map<std::string, std::weak_ptr<phys_ctlr>> known_ctlrs;
+
+        // A new phys_ctlr, or a removal when phys is null
+        struct handoff {
+            std::string devpath;
+            std::shared_ptr<phys_ctlr> phys;
+        };
+        spsc_queue<struct handoff, 64> handoffs;
+        int handoff_fd;
+        std::shared_ptr<epoll_subscriber> handoff_subscriber;
+
+        worker_thread *pick_worker();
+        worker_thread *worker_of(const virt_ctlr *virt);
+        epoll_mgr& epoll_of(worker_thread *worker);
+        void run_on(worker_thread *worker, std::function<void()> task);
+        void destroy_virt_ctlr(std::unique_ptr<virt_ctlr>& virt);
+
+        void hand_off(struct handoff&& handoff);
+        void handle_handoffs();
+        void pair_ctlr(std::shared_ptr<phys_ctlr> phys);
+        void unpair_ctlr(const std::string& devpath);
+        void set_phys_leds(std::shared_ptr<phys_ctlr> phys, int player);
+        void update_cpu_latency();
+
+        bool handle_pairing_events(std::shared_ptr<phys_ctlr> ctlr);
+        void subscribe_phys_ctlr(std::shared_ptr<phys_ctlr> phys, virt_ctlr *owner);
+        void unsubscribe_phys_ctlr(std::string const &devpath);
         void add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys);
         void add_combined_ctlr();
         void add_virt_procon_ctlr(std::shared_ptr<phys_ctlr> phys);
 
     public:
-        ctlr_mgr(epoll_mgr& epoll_manager);
+        ctlr_mgr(epoll_mgr& epoll_manager, worker_thread& control, const joycond_config& config,
+                 metrics_registry& metrics);
         ~ctlr_mgr();
 
+        // Called by the detectors on the control thread
         void add_ctlr(const std::string& devpath, const std::string& devname);
         void remove_ctlr(const std::string& devpath);
+        // A LED class device appeared at syspath
+        void add_led(const std::string& syspath);
 };
 
 #endif
@@ -1,24 +1,138 @@
 #ifndef JOYCOND_EPOLL_MGR_H
 #define JOYCOND_EPOLL_MGR_H
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include "epoll_subscriber.h"
+#include "metrics.h"
+#include "timer_wheel.h"
 
 class epoll_mgr
 {
+    public:
+        typedef uint64_t timer_id;
+
+        // Io_Uring waits with multishot polls and queues submit_write() calls as SQEs, so that one
+        // io_uring_enter() covers a whole batch. Only available when built with HAVE_IO_URING.
+        enum class Backend { Epoll, Io_Uring };
+
+        // Largest write submit_write() can queue on io_uring; anything bigger is written directly
+        static const size_t MAX_QUEUED_WRITE = 2048;
+
     private:
+        struct uring_state;
+
+        enum Backend backend;
         int epoll_fd;
+        struct uring_state *uring;
         std::map<int, std::shared_ptr<epoll_subscriber>> subscribers;
+        // Removed subscribers are kept alive until the current batch of events has been dispatched
+        std::vector<std::shared_ptr<epoll_subscriber>> removed_subscribers;
+        uint64_t wakeup_ns;
+        // Endpoint whose callback is running, and the ones that ran out of budget and want another turn
+        struct epoll_endpoint *current;
+        std::vector<struct epoll_endpoint *> deferred;
+        std::vector<struct epoll_endpoint *> deferred_turn;
+        // Endpoints that relayed input within their busy poll window, read again on every loop turn
+        std::vector<struct epoll_endpoint *> hot;
+        std::vector<struct epoll_endpoint *> hot_turn;
+
+        int timer_fd;
+        std::shared_ptr<epoll_subscriber> timer_subscriber;
+        timer_wheel timers;
+        // Expiry the timerfd is armed for; 0 while disarmed
+        uint64_t armed_ns;
+        // Timers taken off the wheel that are still being run; cancelling one clears its callback
+        std::vector<struct timer_wheel::timer> firing;
+
+        struct alignas(64) {
+            metric_counter wakeups;
+            metric_counter timeouts;
+            metric_counter syscalls;
+            metric_counter relay_allocations;
+            metric_counter relay_page_faults;
+            metric_counter busy_polls;
+            metric_counter busy_poll_hits;
+            metric_counter busy_poll_ns;
+            metric_counter busy_poll_throttled;
+            metric_counter deferred_turns;
+        } loop_stats;
+        // Guards insertion into callback_stats against concurrent collection
+        std::mutex stats_lock;
+        std::map<std::string, std::unique_ptr<struct callback_stats>> callback_stats;
+
+        // Set by set_realtime(); the check timer reports what the relay path did since the last check
+        std::string realtime_name;
+        timer_id realtime_timer;
+        uint64_t realtime_allocs_seen;
+        uint64_t realtime_faults_seen;
+
+        // Busy polling may take budget_ns of every BUSY_POLL_PERIOD_NS
+        uint64_t busy_poll_budget_ns;
+        uint64_t busy_poll_period_start;
+        uint64_t busy_poll_spent_ns;
+
+        void arm_timer_fd();
+        void handle_timers();
+        uint64_t dispatch(struct epoll_endpoint *endpoint, uint64_t start_ns);
+        uint64_t dispatch_deferred(uint64_t start_ns);
+        void defer_endpoint(struct epoll_endpoint *endpoint);
+        struct epoll_endpoint *find_endpoint(int fd);
+        uint64_t busy_poll_turn();
+        void dispatch_hot(uint64_t turn_ns, uint64_t start_ns);
+        void cool_hot();
+        void check_realtime();
+
+        // Implemented in epoll_mgr_uring.cpp
+        void uring_init();
+        void uring_exit();
+        void uring_add(struct epoll_endpoint& endpoint, std::shared_ptr<epoll_subscriber> sub);
+        void uring_remove(struct epoll_endpoint& endpoint);
+        void uring_loop();
+        void uring_write(int fd, const void *buf, size_t len);
+        void uring_submit();
+        void uring_flush();
 
     public:
-        epoll_mgr();
+        epoll_mgr(enum Backend backend = Backend::Epoll);
         ~epoll_mgr();
 
         void add_subscriber(std::shared_ptr<epoll_subscriber> sub);
         void remove_subscriber(std::shared_ptr<epoll_subscriber> sub);
         void loop();
+        // Runs callback from the loop once delay_ns has passed; ids are never 0
+        timer_id add_timer(uint64_t delay_ns, std::function<void()> callback);
+        void cancel_timer(timer_id id);
+        // write(), or on io_uring a queued write submitted with the next wait. Queued writes
+        // report success here and log their errors when they complete.
+        ssize_t submit_write(int fd, const void *buf, size_t len);
+        // Returns once every write queued by submit_write() is done. Whoever stops writing to an fd
+        // that may be closed next calls this; remove_subscriber() does it for the fds it removes.
+        void flush_writes();
+        // Runs this loop's thread at SCHED_FIFO priority and starts logging heap allocations in
+        // relay callbacks and page faults on the thread. Must be called on the loop's thread.
+        void set_realtime(int priority, std::string const &name);
+        // Percentage of this loop's time that may go to busy polling; 0 disables busy polling
+        void set_busy_poll_budget(unsigned int percent);
+        // Keeps calling the subscriber of fd, which must read without blocking, on every loop turn
+        // until window_ns pass without it calling this again. While any fd is busy polled the loop
+        // doesn't sleep, so the others and timers are still served between polls.
+        void busy_poll(int fd, uint64_t window_ns);
+        // For a callback that stopped at its event budget with input left: calls it again on the
+        // next loop turn, after everything else that is ready, instead of letting it drain the fd
+        void defer_current();
+        // defer_current() for the subscriber of fd, when a callback reads from an fd other than its own
+        void defer(int fd);
+        // CLOCK_MONOTONIC time at which the events being dispatched were dequeued
+        uint64_t get_wakeup_ns() const { return wakeup_ns; }
+        void write_metrics(metrics_writer& writer, std::string const &labels);
 };
 
 #endif
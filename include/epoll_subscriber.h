@@ -1,22 +1,63 @@
 #ifndef JOYCOND_EPOLL_SUBSCRIBER_H
 #define JOYCOND_EPOLL_SUBSCRIBER_H
 
+#include <cstdint>
 #include <functional>
+#include <string>
 #include <vector>
 
+#include "metrics.h"
+
+class epoll_subscriber;
+
+// Registered as epoll_event.data.ptr so a wakeup reaches its subscriber without any lookup
+struct epoll_endpoint
+{
+    epoll_subscriber *subscriber;
+    int fd;
+    // Queued to be called again on the next loop turn, and for how many turns in a row
+    bool deferred;
+    unsigned int deferred_turns;
+    // Busy polled every loop turn until this CLOCK_MONOTONIC time; 0 while not busy polled
+    uint64_t hot_until;
+};
+
+// Time spent in the callbacks of every subscriber sharing a name
+struct alignas(64) callback_stats
+{
+    metric_counter calls;
+    metric_counter ns;
+    metric_counter deferrals;
+};
+
 class epoll_subscriber
 {
     private:
         std::function<void(int)> event_callback;
         std::vector<int> event_fds;
+        std::vector<struct epoll_endpoint> endpoints;
+        bool active;
+        bool relay;
+        std::string name;
+        struct callback_stats *stats;
 
     public:
-        epoll_subscriber(std::vector<int> fds, std::function<void(int event_fd)> callback);
+        epoll_subscriber(std::vector<int> fds, std::function<void(int event_fd)> callback,
+                         std::string const &name = "other");
 
         ~epoll_subscriber();
 
         void operator() (int event_fd);
         const std::vector<int>& get_event_fds() const;
+        std::vector<struct epoll_endpoint>& get_endpoints() { return endpoints; }
+        bool is_active() const { return active; }
+        void set_active(bool active) { this->active = active; }
+        // Relay callbacks are expected not to allocate; epoll_mgr counts it when they do
+        bool is_relay() const { return relay; }
+        void set_relay(bool relay) { this->relay = relay; }
+        std::string const &get_name() const { return name; }
+        struct callback_stats *get_stats() const { return stats; }
+        void set_stats(struct callback_stats *stats) { this->stats = stats; }
 };
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef JOYCOND_FF_EFFECT_TABLE_H
+#define JOYCOND_FF_EFFECT_TABLE_H
+
+#include <cstdint>
+#include <linux/input.h>
+#include <vector>
+
+#include "ff_pipeline.h"
+#include "rumble_scheduler.h"
+
+// Effects uploaded to a virtual controller, indexed by virtual effect id, with the id each one has on
+// every physical side. A side that disconnects loses its ids, and an effect is uploaded to it again
+// only when it is next played.
+class ff_effect_table
+{
+    public:
+        static const unsigned int MAX_SIDES = 2;
+        // Used when the uinput device's limit can't be read back
+        static const unsigned int DEFAULT_EFFECTS = 16;
+        // Phys ids that aren't ids on the device
+        enum : int16_t { NOT_UPLOADED = -1, UPLOADING = -2 };
+
+    private:
+        struct slot {
+            bool used;
+            // Bumped whenever the effect is replaced or erased, so stale lazy uploads notice
+            uint32_t generation;
+            struct ff_effect effect;
+            int16_t phys_id[MAX_SIDES];
+            // Latest play/stop that came in while its side was uploading; -1 for none
+            int32_t pending[MAX_SIDES];
+        };
+
+        std::vector<struct slot> slots;
+
+        struct slot *get(int id);
+
+    public:
+        ff_effect_table();
+
+        // Sizes the table to ff_effects_max of the evdev node the uinput device created
+        void size_from_device(char const *devnode);
+        bool contains(int id) { return get(id) != nullptr; }
+        // Id of effect id on side, or NOT_UPLOADED when the side doesn't have it in place
+        int phys_id(int id, unsigned int side);
+        void store(int id, struct ff_effect const &effect, int16_t const phys_ids[MAX_SIDES]);
+        void erase(int id);
+        // fd has gone away, taking every effect uploaded to it along
+        void forget_side(unsigned int side);
+        // Queues a play or stop of virtual effect ev.code on side, uploading it there first if needed;
+        // returns false for an unknown effect
+        bool play(struct input_event const &ev, unsigned int side, int fd, ff_pipeline& jobs,
+                  rumble_scheduler& rumble);
+};
+
+#endif
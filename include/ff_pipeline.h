@@ -0,0 +1,39 @@
+#ifndef JOYCOND_FF_PIPELINE_H
+#define JOYCOND_FF_PIPELINE_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "epoll_mgr.h"
+#include "worker_thread.h"
+
+// Runs a virtual controller's force feedback ioctls on the ff worker, so slow Bluetooth round trips
+// don't stall input relay. Jobs run in submission order and each returns a completion, which runs
+// back on the loop that owns the pipeline, again in order; that's where uinput requests are answered.
+class ff_pipeline
+{
+    public:
+        typedef std::function<void()> completion;
+
+    private:
+        epoll_mgr& epoll_manager;
+        worker_thread& worker;
+        int done_fd;
+        std::shared_ptr<epoll_subscriber> subscriber;
+        std::mutex done_lock;
+        std::vector<completion> done;
+
+        void handle_done();
+
+    public:
+        ff_pipeline(epoll_mgr& epoll_manager, worker_thread& worker);
+        ~ff_pipeline();
+
+        void submit(std::function<completion()> job);
+        // Waits for every job submitted so far and runs their completions
+        void drain();
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef JOYCOND_FUZZ_TUNER_H
+#define JOYCOND_FUZZ_TUNER_H
+
+#include <atomic>
+#include <cstdint>
+#include <libevdev/libevdev.h>
+#include <string>
+
+// Measures how much a controller's sticks jitter while resting and raises the kernel's fuzz for
+// an axis (EVIOCSABS) until the jitter is dropped before it ever reaches user space, up to a
+// multiple of the driver's own fuzz. Tuned values are kept per controller in a file, along with
+// the driver's fuzz so that it can be restored. add_event() runs on whichever thread reads the
+// controller; save() may run on any other.
+class fuzz_tuner
+{
+    public:
+        static const int AXES = 4;
+        // Resting deltas collected before an axis is retuned
+        static const unsigned int SAMPLES = 4096;
+        static const int BUCKET_WIDTH = 8;
+        static const int BUCKETS = 128;
+        // Only movement within this distance of the centre counts as resting
+        static const int REST_RANGE = 4096;
+        // ...and only once the stick has stayed within STILL_BAND of one spot for STILL_REPORTS
+        // reports in a row, so that slow aiming isn't taken for jitter
+        static const int STILL_BAND = 256;
+        static const unsigned int STILL_REPORTS = 8;
+        // Tuned fuzz stays within MAX_FUZZ_FACTOR times the driver's fuzz, or MIN_FUZZ_LIMIT if that is lower
+        static const int MAX_FUZZ_FACTOR = 2;
+        static const int MIN_FUZZ_LIMIT = 64;
+        static const int MAX_FUZZ = 1024;
+
+    private:
+        struct axis {
+            unsigned int code;
+            bool present;
+            // The driver's fuzz and the most tuning may raise it to
+            int base_fuzz;
+            int limit;
+            int anchor;
+            unsigned int still;
+            int last;
+            unsigned int samples;
+            uint16_t histogram[BUCKETS];
+            std::atomic<int> fuzz;
+        };
+
+        struct libevdev *evdev;
+        std::string path;
+        struct axis axes[AXES];
+        std::atomic<bool> dirty;
+
+        static int axis_index(unsigned int code);
+        static int fuzz_limit(int base_fuzz);
+        bool apply(struct axis& ax, int fuzz);
+        void tune(struct axis& ax);
+        void load(bool reset);
+
+    public:
+        // With reset, values tuned by earlier runs are discarded and the driver's fuzz put back
+        fuzz_tuner(struct libevdev *evdev, std::string const &path, bool reset);
+        ~fuzz_tuner();
+
+        void add_event(struct input_event const &ev);
+        // Writes the tuned values if they changed since the last save
+        void save();
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef JOYCOND_CONFIG_H
+#define JOYCOND_CONFIG_H
+
+#include <string>
+#include <vector>
+
+#if defined(ANDROID) || defined(__ANDROID__)
+#define JOYCOND_REMAP_DIR "/vendor/etc/joycond/remap.d"
+#define JOYCOND_STATE_DIR "/data/vendor/joycond"
+#else
+#define JOYCOND_REMAP_DIR "/etc/joycond/remap.d"
+#define JOYCOND_STATE_DIR "/var/lib/joycond"
+#endif
+
+#define JOYCOND_METRICS_SOCKET "/run/joycond/metrics.sock"
+
+#define JOYCOND_RT_PRIORITY 50
+
+#define JOYCOND_PM_QOS_LATENCY 20
+
+// Runtime options, filled in from the command line by main()
+struct joycond_config
+{
+    // Read evdev reports straight from the fd; libevdev is only used to resync after SYN_DROPPED
+    bool raw_read = false;
+
+    // Directory holding the user's *.conf remap profiles
+    std::string remap_dir = JOYCOND_REMAP_DIR;
+
+    // How long combined Joy-Cons hold one side's frame waiting for the other side; 0 disables merging
+    unsigned int merge_window_us = 0;
+
+    // Publish each virtual controller's state into shared memory under /run/joycond
+    bool export_state = false;
+
+    // Unix socket answering each connection with Prometheus text metrics; empty disables it
+    std::string metrics_socket;
+
+    // Permissions and group of the metrics socket; connecting needs write permission, and the metrics
+    // include controller MAC addresses. An empty group keeps the daemon's.
+    unsigned int metrics_mode = 0660;
+    std::string metrics_group;
+
+    // Number of relay threads virtual controllers are spread over; 0 relays on the main thread
+    unsigned int workers = 0;
+
+    // CPUs the relay threads are pinned to, assigned round-robin; empty leaves them unpinned
+    std::vector<int> pin_cpus;
+
+    // Relay loops wait and write through io_uring instead of epoll; needs a HAVE_IO_URING build
+    bool io_uring = false;
+
+    // SCHED_FIFO priority of the relay threads, which also locks memory and reports allocations
+    // and page faults on the relay path; 0 leaves scheduling alone
+    int realtime_priority = 0;
+
+    // After relaying input, keep reading the controller without sleeping for this long; 0 disables it.
+    // Remap profiles can override it per controller.
+    unsigned int busy_poll_us = 0;
+
+    // Share of each relay thread's time busy polling may use, in percent
+    unsigned int busy_poll_budget = 20;
+
+    // Most stick-only frames per second written to each virtual controller; the rest are merged into
+    // the next write. Button changes always go out at once. 0 relays every frame; remap profiles can
+    // override it per controller.
+    unsigned int max_rate_hz = 0;
+
+    // Most rumble reports per second sent to each physical controller; commands in between are
+    // collapsed to the latest one per effect. 0 forwards every command.
+    unsigned int rumble_rate_hz = 0;
+
+    // CPU wakeup latency requested through /dev/cpu_dma_latency while controllers are in use;
+    // negative leaves power management alone
+    int pm_qos_latency_us = -1;
+
+    // How long paired controllers may go without input before the latency request is dropped
+    unsigned int pm_qos_idle_s = 60;
+
+    // Raise the kernel's stick fuzz of each controller to hide the jitter measured while relaying
+    bool adaptive_fuzz = false;
+    // Start tuning over from the driver's fuzz instead of the values saved by earlier runs
+    bool reset_fuzz = false;
+
+    // Where state learnt about individual controllers, such as tuned fuzz, is kept
+    std::string state_dir = JOYCOND_STATE_DIR;
+};
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Layout of the controller state snapshots joycond publishes under /run/joycond/.
+ *
+ * One file per virtual controller, named after its evdev node (e.g. /run/joycond/event23).
+ * mmap() it read-only and read it with the seqlock protocol, which needs no syscalls:
+ *
+ *     do {
+ *         seq = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE);
+ *         copy = *state;
+ *         __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *     } while ((seq & 1) || seq != __atomic_load_n(&state->seq, __ATOMIC_RELAXED));
+ *
+ * This header is meant to be usable from C as well.
+ */
+#ifndef JOYCOND_SHM_H
+#define JOYCOND_SHM_H
+
+#include <linux/input.h>
+#include <stdint.h>
+
+#define JOYCOND_SHM_DIR "/run/joycond"
+#define JOYCOND_SHM_MAGIC 0x4443594a /* "JYCD" */
+#define JOYCOND_SHM_VERSION 1
+
+struct joycond_shm_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;                               /* odd while joycond is updating the snapshot */
+    uint32_t reserved;
+    uint64_t timestamp_ns;                      /* CLOCK_MONOTONIC time of the last update */
+    uint64_t frames;                            /* number of updates so far */
+    uint64_t buttons[(KEY_CNT + 63) / 64];      /* one bit per EV_KEY code */
+    int32_t axes[ABS_CNT];                      /* last value per EV_ABS code */
+};
+
+#endif
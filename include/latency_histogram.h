@@ -0,0 +1,56 @@
+#ifndef JOYCOND_LATENCY_HISTOGRAM_H
+#define JOYCOND_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond latencies: every power of two is split into SUB_BUCKETS
+// linear buckets, which keeps the relative error under 1/SUB_BUCKETS at any magnitude.
+// There is a single writer; readers on other threads only ever see relaxed loads.
+class latency_histogram
+{
+    public:
+        static const unsigned int SUB_BITS = 3;
+        static const unsigned int SUB_BUCKETS = 1 << SUB_BITS;
+        static const unsigned int MAX_BITS = 34; // values are clamped to ~17 seconds
+        static const unsigned int NUM_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    private:
+        std::atomic<uint64_t> buckets[NUM_BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+
+        static void bump(std::atomic<uint64_t> &counter, uint64_t val)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+        }
+
+    public:
+        latency_histogram();
+
+        static unsigned int bucket_of(uint64_t ns)
+        {
+            if (ns >= (1ULL << MAX_BITS))
+                ns = (1ULL << MAX_BITS) - 1;
+            if (ns < SUB_BUCKETS)
+                return ns;
+
+            unsigned int shift = 63 - __builtin_clzll(ns) - SUB_BITS;
+            return (shift + 1) * SUB_BUCKETS + ((ns >> shift) & (SUB_BUCKETS - 1));
+        }
+        static uint64_t bucket_lower_bound(unsigned int bucket);
+
+        void record(uint64_t ns)
+        {
+            bump(buckets[bucket_of(ns)], 1);
+            bump(count, 1);
+            bump(sum, ns);
+        }
+
+        uint64_t get_count() const { return count.load(std::memory_order_relaxed); }
+        uint64_t get_sum() const { return sum.load(std::memory_order_relaxed); }
+        uint64_t get_bucket(unsigned int bucket) const { return buckets[bucket].load(std::memory_order_relaxed); }
+        uint64_t percentile(double p) const;
+};
+
+#endif
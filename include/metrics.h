@@ -0,0 +1,66 @@
+#ifndef JOYCOND_METRICS_H
+#define JOYCOND_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "latency_histogram.h"
+
+// Monotonic counter with a single writer; readers on other threads only see relaxed loads
+class metric_counter
+{
+    private:
+        std::atomic<uint64_t> value;
+
+    public:
+        metric_counter() : value(0) {}
+
+        void add(uint64_t n = 1) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+// Accumulates samples grouped by metric family and renders them in the Prometheus text format
+class metrics_writer
+{
+    private:
+        struct family {
+            std::string help;
+            std::string type;
+            std::vector<std::string> samples;
+        };
+
+        std::vector<std::string> order;
+        std::map<std::string, struct family> families;
+
+        struct family& get_family(std::string const &name, std::string const &help, std::string const &type);
+
+    public:
+        // name="value", with value escaped the way the text format wants
+        static std::string label(std::string const &name, std::string const &value);
+
+        void counter(std::string const &name, std::string const &help, std::string const &labels, uint64_t value);
+        void counter(std::string const &name, std::string const &help, std::string const &labels, double value);
+        void summary(std::string const &name, std::string const &help, std::string const &labels,
+                     const latency_histogram &hist);
+        std::string str() const;
+};
+
+// Everything that can report metrics registers a callback here for as long as it is alive
+class metrics_registry
+{
+    private:
+        std::mutex lock;
+        std::map<const void *, std::function<void(metrics_writer&)>> sources;
+
+    public:
+        void add_source(const void *owner, std::function<void(metrics_writer&)> source);
+        void remove_source(const void *owner);
+        std::string collect();
+};
+
+#endif
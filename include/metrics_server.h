@@ -0,0 +1,28 @@
+#ifndef JOYCOND_METRICS_SERVER_H
+#define JOYCOND_METRICS_SERVER_H
+
+#include <memory>
+#include <string>
+
+#include "epoll_mgr.h"
+#include "joycond_config.h"
+#include "metrics.h"
+
+// Answers every connection on a Unix socket with the current metrics, then hangs up
+class metrics_server
+{
+    private:
+        metrics_registry& metrics;
+        epoll_mgr& epoll_manager;
+        std::shared_ptr<epoll_subscriber> subscriber;
+        std::string path;
+        int sock_fd;
+
+        void epoll_event_callback(int event_fd);
+
+    public:
+        metrics_server(metrics_registry& metrics, epoll_mgr& epoll_manager, const joycond_config& config);
+        ~metrics_server();
+};
+
+#endif
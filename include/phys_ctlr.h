@@ -1,36 +1,94 @@
 #ifndef JOYCOND_PHYS_CTLR_H
 #define JOYCOND_PHYS_CTLR_H
 
-#include <fstream>
+#include <cstdint>
 #include <libevdev/libevdev.h>
+#include <memory>
 #include <optional>
 #include <string>
 
+#include "epoll_mgr.h"
+#include "fuzz_tuner.h"
+#include "joycond_config.h"
+#include "metrics.h"
+#include "sysfs_led.h"
+
 class phys_ctlr
 {
     public:
         enum class Model { Procon, Snescon, Left_Joycon, Right_Joycon, Unknown };
         enum class PairingState { Pairing, Lone, Waiting, Horizontal, Virt_Procon };
+        // Which events the kernel queues on our fd: the pairing buttons, everything, or nothing
+        enum class EventMask { Pairing, Relay, None };
+
+        struct alignas(64) read_stats {
+            metric_counter reads;
+            metric_counter events;
+            metric_counter resyncs;
+        };
+
+        static const unsigned int RAW_BUFFER_EVENTS = 64;
+        static const unsigned int LED_RETRIES = 20;
+        static const uint64_t LED_RETRY_NS = 5000000;
+        // The retry interval doubles up to this many times
+        static const unsigned int LED_RETRY_BACKOFF = 4;
+        // Events a callback reads from one controller per loop turn before giving the others a turn;
+        // relaying controllers finish the frame they are in first
+        static const unsigned int EVENT_BUDGET = 64;
+        // How often tuned fuzz values are written out
+        static const uint64_t FUZZ_SAVE_NS = 60000000000ULL;
 
     private:
         std::string devpath;
         std::string devname;
+        epoll_mgr& epoll_manager;
         struct libevdev *evdev;
         bool is_serial;
-        std::fstream player_leds[4];
-        std::fstream player_led_triggers[4];
-        std::fstream home_led;
+        sysfs_led player_leds[4];
+        sysfs_led home_led;
+        // Canonical sysfs directory the LED class devices appear in, with a trailing slash
+        std::string led_dir;
+        // LED writes requested while the LEDs are still being looked for
+        std::optional<bool> pending_player_leds[4];
+        bool pending_blink[4];
+        std::optional<unsigned short> pending_home_led;
+        epoll_mgr::timer_id led_timer;
+        unsigned int led_retries;
         bool l, zl, r, zr, sl, sr, plus, minus;
         enum Model model;
         std::string mac_addr;
+        bool raw_read;
+        bool resyncing;
+        bool event_mask_supported;
+        struct input_event raw_events[RAW_BUFFER_EVENTS];
+        unsigned int raw_head;
+        unsigned int raw_count;
+        struct read_stats stats;
+        // Set with --adaptive-fuzz and a known MAC; fed by whoever reads the events
+        std::unique_ptr<fuzz_tuner> fuzz;
+        epoll_mgr::timer_id fuzz_timer;
+        // Written from the pairing and LED paths, so kept off the relay's cache line
+        alignas(64) metric_counter led_writes;
+        metric_counter led_writes_skipped;
+        metrics_registry& metrics;
 
         std::optional<std::string> get_first_glob_path(std::string const &pattern);
+        std::string get_hid_dir() const;
         std::optional<std::string> get_led_path(std::string const &name);
+        bool attach_player_led(unsigned int index, std::string const &path);
+        bool attach_home_led(std::string const &path);
+        bool leds_attached() const;
+        bool open_leds();
         void init_leds();
+        void retry_leds();
+        bool start_blink(int index);
+        void count_led_write(enum sysfs_led::Result result);
         void handle_event(struct input_event const &ev);
+        void save_fuzz();
 
     public:
-        phys_ctlr(std::string const &devpath, std::string const &devname);
+        phys_ctlr(std::string const &devpath, std::string const &devname, epoll_mgr& epoll_manager,
+                  joycond_config const &config, metrics_registry& metrics);
         ~phys_ctlr();
 
         std::string const &get_devpath() const { return devpath; }
@@ -39,8 +97,15 @@ class phys_ctlr
         bool set_player_leds_to_player(int player);
         bool set_home_led(unsigned short brightness);
         bool blink_player_leds();
+        // Takes over an LED class device that just appeared at syspath; returns whether it's ours
+        bool attach_led(std::string const &syspath);
         int get_fd();
-        void handle_events();
+        // Returns true when it stopped at EVENT_BUDGET and more input may be waiting
+        bool handle_events();
+        void set_event_mask(enum EventMask mask);
+        int next_event(struct input_event &ev);
+        const struct read_stats& get_read_stats() const { return stats; }
+        void write_metrics(metrics_writer& writer) const;
         enum Model get_model() const { return model; }
         enum PairingState get_pairing_state() const;
         void grab() { libevdev_grab(evdev, LIBEVDEV_GRAB); }
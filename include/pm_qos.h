@@ -0,0 +1,58 @@
+#ifndef JOYCOND_PM_QOS_H
+#define JOYCOND_PM_QOS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "epoll_mgr.h"
+#include "joycond_config.h"
+#include "metrics.h"
+
+// Holds a /dev/cpu_dma_latency request, keeping CPUs out of deep C-states, while controllers are
+// paired and one of them has seen input within the idle period. Everything but touch() runs on
+// the loop the object was created on.
+class pm_qos
+{
+    private:
+        epoll_mgr& epoll_manager;
+        metrics_registry& metrics;
+        int latency_us;
+        uint64_t idle_ns;
+        // Whether any controller is paired
+        bool active;
+        // Open while the request is held; closing it drops the request
+        int qos_fd;
+        epoll_mgr::timer_id idle_timer;
+
+        // Shared with the relay threads
+        std::atomic<bool> held;
+        std::atomic<bool> wake_pending;
+        std::atomic<uint64_t> last_input_ns;
+        int wake_fd;
+        std::shared_ptr<epoll_subscriber> subscriber;
+
+        struct alignas(64) {
+            metric_counter acquired;
+            metric_counter released;
+        } stats;
+
+        void acquire();
+        void release();
+        void arm_idle_timer(uint64_t delay_ns);
+        void handle_idle_timer();
+        void handle_wake();
+        void write_metrics(metrics_writer& writer) const;
+
+    public:
+        pm_qos(epoll_mgr& epoll_manager, const joycond_config& config, metrics_registry& metrics);
+        ~pm_qos();
+
+        bool is_enabled() const { return latency_us >= 0; }
+        // Called on pairing and unpairing with whether any controller is paired now
+        void set_active(bool active);
+        // Called by relay threads for every batch of input, with the time it arrived
+        void touch(uint64_t now_ns);
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef JOYCOND_REALTIME_H
+#define JOYCOND_REALTIME_H
+
+#include <cstdint>
+
+// Locks all current and future memory and stops malloc from handing memory back to the kernel,
+// so nothing the relay path touches has to be faulted in again. Call once, early in main().
+bool realtime_lock_memory();
+
+// Moves the calling thread to SCHED_FIFO at priority and prefaults its stack
+bool realtime_enter_thread(int priority);
+
+// Puts the calling thread on SCHED_OTHER, whatever it inherited from the thread that created it
+bool realtime_leave_thread();
+
+// Marks code the calling thread runs on the relay path; heap allocations made inside are counted
+class realtime_section
+{
+    public:
+        realtime_section();
+        ~realtime_section();
+};
+
+// Heap allocations the calling thread has made inside a realtime_section
+uint64_t realtime_allocations();
+
+#endif
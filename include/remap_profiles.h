@@ -0,0 +1,54 @@
+#ifndef JOYCOND_REMAP_PROFILES_H
+#define JOYCOND_REMAP_PROFILES_H
+
+#include <libevdev/libevdev.h>
+#include <string>
+#include <vector>
+
+#include "phys_ctlr.h"
+#include "remap_table.h"
+
+// User remap profiles read from the config directory, compiled on top of the built-in tables
+class remap_profiles
+{
+    private:
+        struct rule {
+            unsigned int type;
+            unsigned int code;
+            unsigned int to_type;
+            unsigned int to_code;
+            int scale;
+        };
+
+        struct profile {
+            std::string name;
+            std::vector<enum phys_ctlr::Model> models;
+            std::vector<std::string> macs;
+            std::vector<struct rule> rules;
+            // -1 leaves the busy poll window to the command line
+            int busy_poll_us = -1;
+            // -1 leaves the output rate limit to the command line
+            int max_rate_hz = -1;
+        };
+
+        std::vector<struct profile> profiles;
+
+        bool parse_code(std::string const &name, unsigned int &type, unsigned int &code) const;
+        bool parse_profile(std::string const &path);
+        std::vector<const struct profile *> matching_profiles(phys_ctlr &phys) const;
+
+    public:
+        remap_profiles();
+        ~remap_profiles();
+
+        void load(std::string const &dir);
+        void enable_targets(struct libevdev *virt_evdev, phys_ctlr &phys) const;
+        void compile(remap_table &table, const remap_table &base, phys_ctlr &phys,
+                     const struct libevdev *virt_evdev) const;
+        // Busy poll window for phys; the last matching profile setting one wins over default_us
+        unsigned int busy_poll_us(phys_ctlr &phys, unsigned int default_us) const;
+        // Output rate limit for phys, chosen the same way
+        unsigned int max_rate_hz(phys_ctlr &phys, unsigned int default_hz) const;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef JOYCOND_REMAP_TABLE_H
+#define JOYCOND_REMAP_TABLE_H
+
+#include <array>
+#include <cstdint>
+#include <linux/input.h>
+
+// Where one (type, code) of a physical controller ends up on the virtual device
+struct remap_entry
+{
+    uint16_t type;
+    uint16_t code;
+    int8_t scale; // multiplied into the value; 0 drops the event
+};
+
+// Dense lookup table for EV_KEY and EV_ABS codes; every other event type passes through untouched
+class remap_table
+{
+    private:
+        std::array<struct remap_entry, KEY_CNT> keys;
+        std::array<struct remap_entry, ABS_CNT> axes;
+
+    public:
+        constexpr remap_table() : keys(), axes()
+        {
+            for (unsigned int code = 0; code < KEY_CNT; code++)
+                keys[code] = { EV_KEY, (uint16_t)code, 1 };
+            for (unsigned int code = 0; code < ABS_CNT; code++)
+                axes[code] = { EV_ABS, (uint16_t)code, 1 };
+        }
+
+        constexpr struct remap_entry *entry(unsigned int type, unsigned int code)
+        {
+            if (type == EV_KEY && code < KEY_CNT)
+                return &keys[code];
+            if (type == EV_ABS && code < ABS_CNT)
+                return &axes[code];
+            return nullptr;
+        }
+
+        constexpr remap_table& map(unsigned int type, unsigned int code,
+                                   unsigned int to_type, unsigned int to_code, int scale = 1)
+        {
+            struct remap_entry *e = entry(type, code);
+            if (e)
+                *e = { (uint16_t)to_type, (uint16_t)to_code, (int8_t)scale };
+            return *this;
+        }
+
+        constexpr remap_table& drop(unsigned int type, unsigned int code)
+        {
+            struct remap_entry *e = entry(type, code);
+            if (e)
+                e->scale = 0;
+            return *this;
+        }
+
+        // Rewrites ev in place; returns false if the event should not be relayed at all
+        bool apply(struct input_event &ev) const
+        {
+            const struct remap_entry *e;
+
+            if (ev.type == EV_KEY && ev.code < KEY_CNT)
+                e = &keys[ev.code];
+            else if (ev.type == EV_ABS && ev.code < ABS_CNT)
+                e = &axes[ev.code];
+            else
+                return true;
+
+            ev.type = e->type;
+            ev.code = e->code;
+            ev.value *= e->scale;
+            return e->scale != 0;
+        }
+};
+
+// Built-in profiles, generated at compile time
+constexpr remap_table make_combined_remap(bool left, bool serial)
+{
+    remap_table table;
+
+    // The S triggers become misc. buttons, unless connected via serial where they are dropped
+    if (left) {
+        if (serial)
+            table.drop(EV_KEY, BTN_TR).drop(EV_KEY, BTN_TR2);
+        else
+            table.map(EV_KEY, BTN_TR, EV_KEY, BTN_TRIGGER_HAPPY1).map(EV_KEY, BTN_TR2, EV_KEY, BTN_TRIGGER_HAPPY2);
+    } else {
+        if (serial)
+            table.drop(EV_KEY, BTN_TL).drop(EV_KEY, BTN_TL2);
+        else
+            table.map(EV_KEY, BTN_TL, EV_KEY, BTN_TRIGGER_HAPPY3).map(EV_KEY, BTN_TL2, EV_KEY, BTN_TRIGGER_HAPPY4);
+    }
+
+#if defined(ANDROID) || defined(__ANDROID__)
+    // Android wants analog triggers and a HAT for the dpad
+    if (left)
+        table.map(EV_KEY, BTN_TL2, EV_ABS, ABS_Z);
+    else
+        table.map(EV_KEY, BTN_TR2, EV_ABS, ABS_RZ);
+    table.map(EV_KEY, BTN_DPAD_UP, EV_ABS, ABS_HAT0Y, -1);
+    table.map(EV_KEY, BTN_DPAD_DOWN, EV_ABS, ABS_HAT0Y);
+    table.map(EV_KEY, BTN_DPAD_LEFT, EV_ABS, ABS_HAT0X, -1);
+    table.map(EV_KEY, BTN_DPAD_RIGHT, EV_ABS, ABS_HAT0X);
+#endif
+    return table;
+}
+
+constexpr remap_table make_pro_remap()
+{
+    remap_table table;
+
+#if defined(ANDROID) || defined(__ANDROID__)
+    // Android wants analog triggers
+    table.map(EV_KEY, BTN_TL2, EV_ABS, ABS_Z);
+    table.map(EV_KEY, BTN_TR2, EV_ABS, ABS_RZ);
+#endif
+    return table;
+}
+
+inline constexpr remap_table remap_combined_left = make_combined_remap(true, false);
+inline constexpr remap_table remap_combined_left_serial = make_combined_remap(true, true);
+inline constexpr remap_table remap_combined_right = make_combined_remap(false, false);
+inline constexpr remap_table remap_combined_right_serial = make_combined_remap(false, true);
+inline constexpr remap_table remap_pro = make_pro_remap();
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef JOYCOND_RUMBLE_SCHEDULER_H
+#define JOYCOND_RUMBLE_SCHEDULER_H
+
+#include <cstdint>
+#include <linux/input.h>
+#include <string>
+
+#include "epoll_mgr.h"
+#include "metrics.h"
+
+// Forwards EV_FF commands to one physical controller no more often than the configured rate. Commands
+// arriving in between wait for a timer, and a later command for the same effect replaces the waiting
+// one, so a game restarting rumble every frame costs one report per interval.
+class rumble_scheduler
+{
+    public:
+        // More distinct effects than hid-nintendo's memless ff device can hold
+        static const unsigned int MAX_PENDING = 16;
+
+        struct alignas(64) stats {
+            metric_counter commands;
+            metric_counter writes;
+            metric_counter dropped;
+        };
+
+    private:
+        epoll_mgr& epoll_manager;
+        int fd;
+        // 0 writes every command as it arrives
+        uint64_t min_interval_ns;
+        uint64_t last_write_ns;
+        struct input_event pending[MAX_PENDING];
+        unsigned int count;
+        epoll_mgr::timer_id flush_timer;
+        struct stats counters;
+
+    public:
+        rumble_scheduler(epoll_mgr& epoll_manager, unsigned int rate_hz);
+        ~rumble_scheduler();
+
+        // Drops whatever is waiting for the previous controller
+        void set_fd(int fd);
+        void queue(struct input_event const &ev);
+        void flush();
+        void write_metrics(metrics_writer& writer, std::string const &labels) const;
+};
+
+#endif
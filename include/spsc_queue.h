@@ -0,0 +1,47 @@
+#ifndef JOYCOND_SPSC_QUEUE_H
+#define JOYCOND_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread
+template <typename T, size_t N>
+class spsc_queue
+{
+    static_assert(N && !(N & (N - 1)), "spsc_queue size must be a power of two");
+
+    private:
+        T slots[N];
+        // head is only written by the consumer and tail only by the producer
+        alignas(64) std::atomic<size_t> head;
+        alignas(64) std::atomic<size_t> tail;
+
+    public:
+        spsc_queue() : slots(), head(0), tail(0) {}
+
+        bool push(T&& item)
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+
+            if (t - head.load(std::memory_order_acquire) == N)
+                return false;
+            slots[t & (N - 1)] = std::move(item);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T& item)
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+
+            if (h == tail.load(std::memory_order_acquire))
+                return false;
+            item = std::move(slots[h & (N - 1)]);
+            slots[h & (N - 1)] = T();
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef JOYCOND_STATE_EXPORT_H
+#define JOYCOND_STATE_EXPORT_H
+
+#include <linux/input.h>
+#include <string>
+
+#include "joycond_shm.h"
+
+// Publishes a virtual controller's state into a shared memory snapshot guarded by a seqlock
+class state_export
+{
+    private:
+        std::string path;
+        struct joycond_shm_state *state;
+
+    public:
+        state_export();
+        ~state_export();
+
+        bool open(std::string const &name);
+        void close();
+        bool is_open() const { return state != nullptr; }
+        void publish(struct input_event const *events, unsigned int count);
+};
+
+#endif
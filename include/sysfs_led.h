@@ -0,0 +1,37 @@
+#ifndef JOYCOND_SYSFS_LED_H
+#define JOYCOND_SYSFS_LED_H
+
+#include <string>
+
+// An LED class device written through raw fds on its sysfs attributes. Remembers what it last wrote
+// and skips writes that wouldn't change anything; on a Bluetooth controller each one that does go
+// through becomes an HID output report.
+class sysfs_led
+{
+    public:
+        enum class Result { Written, Unchanged, Failed };
+
+    private:
+        int brightness_fd;
+        int trigger_fd;
+        // Last brightness written; -1 while unknown, including while the timer trigger blinks it
+        int brightness;
+        bool blinking;
+
+        bool write_attr(int fd, std::string const &value);
+
+    public:
+        sysfs_led();
+        ~sysfs_led();
+        sysfs_led(const sysfs_led&) = delete;
+        sysfs_led& operator=(const sysfs_led&) = delete;
+
+        // path is the LED's directory; the trigger is only opened when asked for
+        bool open(std::string const &path, bool with_trigger);
+        bool is_open() const { return brightness_fd >= 0; }
+        bool has_trigger() const { return trigger_fd >= 0; }
+        enum Result set_brightness(unsigned int value);
+        enum Result start_blink();
+};
+
+#endif
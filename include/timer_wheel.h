@@ -0,0 +1,42 @@
+#ifndef JOYCOND_TIMER_WHEEL_H
+#define JOYCOND_TIMER_WHEEL_H
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+// Hashed timer wheel; timers are bucketed by millisecond tick but keep their exact expiry,
+// so whoever arms the clock can fire them precisely. Timer ids carry their slot, so adding and
+// cancelling don't allocate once the slots have grown to their working size.
+class timer_wheel
+{
+    public:
+        static const unsigned int SLOTS = 256;
+        static const uint64_t TICK_NS = 1000000;
+
+        struct timer {
+            uint64_t id;
+            uint64_t expiry_ns;
+            std::function<void()> callback;
+        };
+
+    private:
+        std::vector<struct timer> slots[SLOTS];
+        size_t count;
+        uint64_t current_tick;
+        uint64_t next_seq;
+
+    public:
+        timer_wheel();
+        ~timer_wheel();
+
+        uint64_t add(uint64_t expiry_ns, std::function<void()> callback);
+        bool cancel(uint64_t id);
+        // Moves every timer due by now_ns into due, earliest first
+        void expire(uint64_t now_ns, std::vector<struct timer>& due);
+        std::optional<uint64_t> next_expiry() const;
+        bool empty() const { return !count; }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef JOYCOND_UINPUT_FRAME_H
+#define JOYCOND_UINPUT_FRAME_H
+
+#include <cstdint>
+#include <linux/input.h>
+#include <string>
+
+#include "epoll_mgr.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "state_export.h"
+
+// Collects the events of one evdev frame so they reach /dev/uinput in a single write(). With a
+// maximum rate set, frames carrying only stick ABS events are held back and coalesced into the
+// next write instead, which goes out no sooner than the rate allows; any other event flushes
+// right away.
+class uinput_frame
+{
+    public:
+        static const unsigned int MAX_EVENTS = 64;
+
+        struct alignas(64) stats {
+            metric_counter frames;
+            metric_counter events;
+            metric_counter writes;
+            metric_counter coalesced;
+        };
+
+        // kernel timestamp -> epoll dequeue -> uinput write completion
+        enum Latency { Kernel_To_Dequeue, Dequeue_To_Write, Kernel_To_Write, Num_Latencies };
+
+    private:
+        int uifd;
+        epoll_mgr& epoll_manager;
+        struct input_event events[MAX_EVENTS];
+        unsigned int count;
+        struct stats counters;
+        state_export *exporter;
+        bool frame_started;
+        uint64_t kernel_ns;
+        uint64_t dequeue_ns;
+        latency_histogram latency[Num_Latencies];
+        // 0 writes every frame as it completes
+        uint64_t min_interval_ns;
+        uint64_t last_write_ns;
+        // Set by events that must not wait for the rate limit
+        bool urgent;
+        epoll_mgr::timer_id flush_timer;
+
+        void flush();
+        void write_frame();
+
+    public:
+        uinput_frame(int uifd, epoll_mgr& epoll_manager);
+        ~uinput_frame();
+
+        void set_uinput_fd(int fd) { uifd = fd; }
+        void set_state_export(state_export *exporter) { this->exporter = exporter; }
+        // Limits ABS-only frames to hz per second; 0 removes the limit
+        void set_max_rate(unsigned int hz);
+        void note_timestamp(struct input_event const &ev);
+        // source_type is the event's type before remapping: an axis remapped from a button (the
+        // Android D-pad and triggers, or a profile) is an edge and must not be coalesced
+        void add_event(struct input_event const &ev, unsigned int source_type);
+        void sync();
+        const struct stats& get_stats() const { return counters; }
+        const latency_histogram& get_latency(enum Latency which) const { return latency[which]; }
+        void print_stats() const;
+        void write_metrics(metrics_writer& writer, std::string const &labels) const;
+};
+
+#endif
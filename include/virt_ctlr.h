@@ -1,6 +1,7 @@
 #ifndef JOYCOND_VIRT_CTLR_H
 #define JOYCOND_VIRT_CTLR_H
 
+#include "metrics.h"
 #include "phys_ctlr.h"
 
 #include <memory>
@@ -11,6 +12,12 @@ class virt_ctlr
     private:
 
     public:
+        struct alignas(64) ff_stats {
+            metric_counter uploads;
+            metric_counter erases;
+            metric_counter plays;
+        };
+
         virt_ctlr() {}
         virtual ~virt_ctlr() {}
 
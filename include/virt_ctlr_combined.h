@@ -4,29 +4,67 @@
 #include "virt_ctlr.h"
 #include "phys_ctlr.h"
 #include "epoll_mgr.h"
+#include "ff_effect_table.h"
+#include "ff_pipeline.h"
+#include "joycond_config.h"
+#include "remap_profiles.h"
+#include "remap_table.h"
+#include "rumble_scheduler.h"
+#include "state_export.h"
+#include "uinput_frame.h"
 
 #include <libevdev/libevdev.h>
-#include <map>
 #include <memory>
 
 class virt_ctlr_combined : public virt_ctlr
 {
     private:
+        // Sides in the ff effect table
+        enum { LEFT, RIGHT };
+
         std::shared_ptr<phys_ctlr> physl;
         std::shared_ptr<phys_ctlr> physr;
         epoll_mgr& epoll_manager;
+        const remap_profiles& remaps;
         std::shared_ptr<epoll_subscriber> subscriber;
         struct libevdev *virt_evdev;
         struct libevdev_uinput *uidev;
         int uifd;
-        std::map<int, std::pair<struct ff_effect, struct ff_effect>> rumble_effects;
+        uinput_frame frame;
+        state_export state;
+        metrics_registry& metrics;
+        std::string name;
+        struct ff_stats ff_counters;
+        ff_effect_table effects;
+        rumble_scheduler rumble_l;
+        rumble_scheduler rumble_r;
         std::string left_mac;
         std::string right_mac;
+        remap_table remap_l;
+        remap_table remap_r;
+        unsigned int merge_window_us;
+        // Pending while one side's frame is held back for merging
+        epoll_mgr::timer_id merge_timer;
+        // Which side's frame is being held; only meaningful while merge_timer is set
+        const phys_ctlr *held_side;
+        // Busy poll window after relaying input; 0 goes straight back to epoll
+        uint64_t busy_poll_ns;
+        // Last, so jobs still running are done before anything they touch goes away
+        ff_pipeline ff_jobs;
 
-        void relay_events(std::shared_ptr<phys_ctlr> phys);
+        void relay_event(std::shared_ptr<phys_ctlr> const &phys, const remap_table& remap, struct input_event &ev);
+        unsigned int relay_events(std::shared_ptr<phys_ctlr> const &phys, const remap_table& remap,
+                                  unsigned int budget);
+        bool relay_turn(std::shared_ptr<phys_ctlr> const &phys, const remap_table& remap);
+        void end_frame(std::shared_ptr<phys_ctlr> const &phys);
+        void handle_merge_timer();
+        void release_held_frame();
         void handle_uinput_event();
+        void write_metrics(metrics_writer& writer) const;
     public:
-        virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl, std::shared_ptr<phys_ctlr> physr, epoll_mgr& epoll_manager);
+        virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl, std::shared_ptr<phys_ctlr> physr,
+                           epoll_mgr& epoll_manager, worker_thread& ff_worker, const remap_profiles& remaps,
+                           const joycond_config& config, metrics_registry& metrics);
         virtual ~virt_ctlr_combined();
 
         virtual void handle_events(int fd);
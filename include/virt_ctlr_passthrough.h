@@ -3,6 +3,7 @@
 
 #include "virt_ctlr.h"
 #include "phys_ctlr.h"
+#include "epoll_mgr.h"
 
 #include <memory>
 
@@ -10,9 +11,10 @@ class virt_ctlr_passthrough : public virt_ctlr
 {
     private:
         std::shared_ptr<phys_ctlr> phys;
+        epoll_mgr& epoll_manager;
 
     public:
-        virt_ctlr_passthrough(std::shared_ptr<phys_ctlr> phys);
+        virt_ctlr_passthrough(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_manager);
         virtual ~virt_ctlr_passthrough();
 
         virtual void handle_events(int fd);
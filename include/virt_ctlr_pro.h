@@ -4,9 +4,16 @@
 #include "virt_ctlr.h"
 #include "phys_ctlr.h"
 #include "epoll_mgr.h"
+#include "ff_effect_table.h"
+#include "ff_pipeline.h"
+#include "joycond_config.h"
+#include "remap_profiles.h"
+#include "remap_table.h"
+#include "rumble_scheduler.h"
+#include "state_export.h"
+#include "uinput_frame.h"
 
 #include <libevdev/libevdev.h>
-#include <map>
 #include <memory>
 
 class virt_ctlr_pro : public virt_ctlr
@@ -14,17 +21,32 @@ class virt_ctlr_pro : public virt_ctlr
     private:
         std::shared_ptr<phys_ctlr> phys;
         epoll_mgr& epoll_manager;
+        const remap_profiles& remaps;
         std::shared_ptr<epoll_subscriber> subscriber;
         struct libevdev *virt_evdev;
         struct libevdev_uinput *uidev;
         int uifd;
-        std::map<int, struct ff_effect> rumble_effects;
+        uinput_frame frame;
+        state_export state;
+        metrics_registry& metrics;
+        std::string name;
+        struct ff_stats ff_counters;
+        ff_effect_table effects;
+        rumble_scheduler rumble;
         std::string mac;
+        remap_table remap;
+        // Busy poll window after relaying input; 0 goes straight back to epoll
+        uint64_t busy_poll_ns;
+        // Last, so jobs still running are done before anything they touch goes away
+        ff_pipeline ff_jobs;
 
-        void relay_events(std::shared_ptr<phys_ctlr> phys);
+        unsigned int relay_events(std::shared_ptr<phys_ctlr> phys, unsigned int budget);
+        bool relay_turn();
         void handle_uinput_event();
+        void write_metrics(metrics_writer& writer) const;
     public:
-        virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_manager);
+        virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_manager, worker_thread& ff_worker,
+                      const remap_profiles& remaps, const joycond_config& config, metrics_registry& metrics);
         virtual ~virt_ctlr_pro();
 
         virtual void handle_events(int fd);
@@ -0,0 +1,48 @@
+#ifndef JOYCOND_WORKER_THREAD_H
+#define JOYCOND_WORKER_THREAD_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "epoll_mgr.h"
+#include "metrics.h"
+
+// A thread running its own epoll_mgr. Everything registered on that epoll_mgr, and every object
+// whose callbacks it runs, may only be touched from this thread; post() gets work there.
+class worker_thread
+{
+    private:
+        std::string name;
+        int cpu;
+        int realtime_priority;
+        metrics_registry& metrics;
+        epoll_mgr epoll_manager;
+        int task_fd;
+        std::shared_ptr<epoll_subscriber> subscriber;
+        std::mutex task_lock;
+        std::vector<std::function<void()>> tasks;
+        bool running;
+        std::thread thread;
+
+        void run();
+        void handle_tasks();
+
+    public:
+        // cpu < 0 leaves the thread unpinned. The thread runs at SCHED_FIFO realtime_priority, or on
+        // SCHED_OTHER for 0, never with whatever policy the creating thread happens to have.
+        worker_thread(std::string const &name, int cpu, metrics_registry& metrics,
+                      enum epoll_mgr::Backend backend = epoll_mgr::Backend::Epoll, int realtime_priority = 0);
+        ~worker_thread();
+
+        epoll_mgr& get_epoll_mgr() { return epoll_manager; }
+        std::string const &get_name() const { return name; }
+        void post(std::function<void()> task);
+        // Runs task on the worker and waits for it; runs it inline when already on the worker
+        void run_sync(std::function<void()> task);
+};
+
+#endif
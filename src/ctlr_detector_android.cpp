@@ -1,5 +1,6 @@
 #include "ctlr_detector_android.h"
 
+#include <fstream>
 #include <sstream>
 #include <iostream>
 #include <stdlib.h>
@@ -122,9 +123,16 @@ void ctlr_detector_android::epoll_event_callback(int event_fd)
 
     devpath = "/class/input/" + std::string(basename(devnode.c_str())) + "/device";
 
-    // Sleep a bit to let driver load
-    usleep(100000);
+    // Give the driver a bit of time to load. Every uevent waits the same amount, so they still
+    // complete in arrival order and the oldest pending timer is always the one firing.
+    pending_uevents.push_back(epoll_manager.add_timer(UEVENT_SETTLE_NS, [=](){
+        pending_uevents.pop_front();
+        handle_uevent(action, devpath, devnode);
+    }));
+}
 
+void ctlr_detector_android::handle_uevent(bool action, std::string devpath, std::string devnode)
+{
     // Check the MAC to handle replacements - disconnects are not reported instantly so otherwise we can end up desynced
     std::ifstream funiq("/sys/" + devpath + "/uniq");
     std::string mac_addr = "";
@@ -204,13 +212,16 @@ ctlr_detector_android::ctlr_detector_android(ctlr_mgr& ctlr_manager, epoll_mgr&
     }
 
     subscriber = std::make_shared<epoll_subscriber>(std::vector({uevent_pollfd.fd}),
-                                                    [=](int event_fd){epoll_event_callback(event_fd);});
+                                                    [=](int event_fd){epoll_event_callback(event_fd);},
+                                                    "netlink");
     epoll_manager.add_subscriber(subscriber);
 
 }
 
 ctlr_detector_android::~ctlr_detector_android()
 {
+    for (auto id : pending_uevents)
+        epoll_manager.cancel_timer(id);
     epoll_manager.remove_subscriber(subscriber);
 }
 
@@ -28,10 +28,24 @@ void ctlr_detector_udev::epoll_event_callback(int event_fd)
     }
 }
 
+void ctlr_detector_udev::led_event_callback(int event_fd)
+{
+    struct udev_device *dev;
+
+    dev = udev_monitor_receive_device(led_mon);
+    if (dev) {
+        if (std::string("add") == udev_device_get_action(dev))
+            ctlr_manager.add_led(udev_device_get_syspath(dev));
+        udev_device_unref(dev);
+    }
+}
+
 //public
 ctlr_detector_udev::ctlr_detector_udev(ctlr_mgr& ctlr_manager, epoll_mgr& epoll_manager) :
     ctlr_manager(ctlr_manager),
-    epoll_manager(epoll_manager)
+    epoll_manager(epoll_manager),
+    led_subscriber(nullptr),
+    led_mon(nullptr)
 {
     udev = udev_new();
     if (!udev) {
@@ -49,9 +63,22 @@ ctlr_detector_udev::ctlr_detector_udev(ctlr_mgr& ctlr_manager, epoll_mgr& epoll_
     udev_mon_fd = udev_monitor_get_fd(mon);
 
     subscriber = std::make_shared<epoll_subscriber>(std::vector({udev_mon_fd}),
-                                                    [=](int event_fd){epoll_event_callback(event_fd);});
+                                                    [=](int event_fd){epoll_event_callback(event_fd);},
+                                                    "udev");
     epoll_manager.add_subscriber(subscriber);
 
+    // Without it controllers still find their LEDs, just by polling for them
+    led_mon = udev_monitor_new_from_netlink(udev, "udev");
+    if (led_mon && !udev_monitor_filter_add_match_subsystem_devtype(led_mon, "leds", NULL) &&
+        !udev_monitor_enable_receiving(led_mon)) {
+        led_subscriber = std::make_shared<epoll_subscriber>(std::vector({udev_monitor_get_fd(led_mon)}),
+                                                            [=](int event_fd){led_event_callback(event_fd);},
+                                                            "udev-leds");
+        epoll_manager.add_subscriber(led_subscriber);
+    } else {
+        std::cerr << "Failed to monitor LED devices; falling back to polling for them\n";
+    }
+
     // Detect any existing controllers prior to daemon start
     struct udev_enumerate *enumerate;
     struct udev_list_entry *devlist;
@@ -82,5 +109,9 @@ ctlr_detector_udev::ctlr_detector_udev(ctlr_mgr& ctlr_manager, epoll_mgr& epoll_
 ctlr_detector_udev::~ctlr_detector_udev()
 {
     epoll_manager.remove_subscriber(subscriber);
+    if (led_subscriber)
+        epoll_manager.remove_subscriber(led_subscriber);
+    if (led_mon)
+        udev_monitor_unref(led_mon);
 }
 
@@ -3,70 +3,159 @@
 #include "virt_ctlr_combined.h"
 #include "virt_ctlr_pro.h"
 
+#include <cstring>
 #include <iostream>
+#include <sys/eventfd.h>
+#include <thread>
 #include <unistd.h>
 
 //private
-void ctlr_mgr::epoll_event_callback(int event_fd)
+// Least loaded relay thread, or nullptr when everything runs on the main loop
+worker_thread *ctlr_mgr::pick_worker()
 {
-    for (auto& kv : unpaired_controllers) {
-        auto ctlr = kv.second;
-        if (event_fd == ctlr->get_fd()) {
-            ctlr->handle_events();
-            switch (ctlr->get_pairing_state()) {
-                case phys_ctlr::PairingState::Lone:
-                    std::cout << "Lone controller paired\n";
-                    add_passthrough_ctlr(ctlr);
-                    break;
-                case phys_ctlr::PairingState::Virt_Procon:
-                    std::cout << "Virtual procon paired\n";
-                    add_virt_procon_ctlr(ctlr);
-                    break;
-                case phys_ctlr::PairingState::Waiting:
-                    std::cout << "Waiting controller needs partner\n";
-                    if (ctlr->get_model() == phys_ctlr::Model::Left_Joycon) {
-                        if (!left) {
-                            left = ctlr;
-                            std::cout << "Found left\n";
-                        }
-                    } else {
-                        if (!right) {
-                            right = ctlr;
-                            std::cout << "Found right\n";
-                        }
-                    }
-                    if (left && right) {
-                        add_combined_ctlr();
-                        left = nullptr;
-                        right = nullptr;
-                    }
-                    break;
-                case phys_ctlr::PairingState::Horizontal:
-                    std::cout << "Joy-Con paired in horizontal mode\n";
-                    add_passthrough_ctlr(ctlr);
-                    break;
-                default:
-                    if (left == ctlr)
-                        left = nullptr;
-                    if (right == ctlr)
-                        right = nullptr;
-                    break;
-            }
-            break;
+    worker_thread *best = nullptr;
+    size_t best_load = 0;
+
+    for (auto& worker : workers) {
+        size_t load = 0;
+        for (auto& kv : owners) {
+            if (kv.second == worker.get())
+                load++;
+        }
+        if (!best || load < best_load) {
+            best = worker.get();
+            best_load = load;
         }
     }
+    return best;
+}
 
-    for (auto& ctlr : paired_controllers) {
-        if (!ctlr)
-            continue;
-        if (ctlr->contains_fd(event_fd))
-            ctlr->handle_events(event_fd);
+worker_thread *ctlr_mgr::worker_of(const virt_ctlr *virt)
+{
+    auto it = owners.find(virt);
+    return it == owners.end() ? nullptr : it->second;
+}
+
+epoll_mgr& ctlr_mgr::epoll_of(worker_thread *worker)
+{
+    return worker ? worker->get_epoll_mgr() : epoll_manager;
+}
+
+// Anything that changes what a relay thread is working with has to happen on that thread
+void ctlr_mgr::run_on(worker_thread *worker, std::function<void()> task)
+{
+    if (worker)
+        worker->run_sync(task);
+    else
+        task();
+}
+
+void ctlr_mgr::destroy_virt_ctlr(std::unique_ptr<virt_ctlr>& virt)
+{
+    worker_thread *worker = worker_of(virt.get());
+    // Hold on to the phys_ctlrs so they're released here; their LEDs and timers live on this thread
+    auto phys = virt->get_phys_ctlrs();
+
+    owners.erase(virt.get());
+    run_on(worker, [&](){virt.reset();});
+}
+
+// Returns true when the controller has more input than it was allowed to read this turn
+bool ctlr_mgr::handle_pairing_events(std::shared_ptr<phys_ctlr> ctlr)
+{
+    bool more = ctlr->handle_events();
+    switch (ctlr->get_pairing_state()) {
+        case phys_ctlr::PairingState::Lone:
+            std::cout << "Lone controller paired\n";
+            add_passthrough_ctlr(ctlr);
+            break;
+        case phys_ctlr::PairingState::Virt_Procon:
+            std::cout << "Virtual procon paired\n";
+            add_virt_procon_ctlr(ctlr);
+            break;
+        case phys_ctlr::PairingState::Waiting:
+            std::cout << "Waiting controller needs partner\n";
+            if (ctlr->get_model() == phys_ctlr::Model::Left_Joycon) {
+                if (!left) {
+                    left = ctlr;
+                    std::cout << "Found left\n";
+                }
+            } else {
+                if (!right) {
+                    right = ctlr;
+                    std::cout << "Found right\n";
+                }
+            }
+            if (left && right) {
+                add_combined_ctlr();
+                left = nullptr;
+                right = nullptr;
+            }
+            break;
+        case phys_ctlr::PairingState::Horizontal:
+            std::cout << "Joy-Con paired in horizontal mode\n";
+            add_passthrough_ctlr(ctlr);
+            break;
+        default:
+            if (left == ctlr)
+                left = nullptr;
+            if (right == ctlr)
+                right = nullptr;
+            break;
     }
+    update_cpu_latency();
+    return more;
+}
+
+// Points the phys_ctlr's epoll registration straight at whoever consumes its events.
+void ctlr_mgr::subscribe_phys_ctlr(std::shared_ptr<phys_ctlr> phys, virt_ctlr *owner)
+{
+    std::string const &devpath = phys->get_devpath();
+    worker_thread *worker = owner ? worker_of(owner) : nullptr;
+    std::shared_ptr<epoll_subscriber> sub;
+
+    unsubscribe_phys_ctlr(devpath);
+    phys->set_event_mask(owner ? phys_ctlr::EventMask::Relay : phys_ctlr::EventMask::Pairing);
+
+    if (owner) {
+        epoll_mgr *loop = &epoll_of(worker);
+        sub = std::make_shared<epoll_subscriber>(std::vector({phys->get_fd()}),
+                                                 [=](int event_fd){
+                                                     owner->handle_events(event_fd);
+                                                     cpu_latency.touch(loop->get_wakeup_ns());
+                                                 },
+                                                 "relay");
+        sub->set_relay(true);
+    } else
+        sub = std::make_shared<epoll_subscriber>(std::vector({phys->get_fd()}),
+                                                 [=](int event_fd){
+                                                     if (handle_pairing_events(phys))
+                                                         epoll_manager.defer_current();
+                                                 },
+                                                 "pairing");
+    run_on(worker, [&](){epoll_of(worker).add_subscriber(sub);});
+    subscribers[devpath] = { worker, sub };
+}
+
+void ctlr_mgr::unsubscribe_phys_ctlr(std::string const &devpath)
+{
+    auto it = subscribers.find(devpath);
+    if (it == subscribers.end())
+        return;
+
+    worker_thread *worker = it->second.worker;
+    auto sub = it->second.subscriber;
+    run_on(worker, [&](){epoll_of(worker).remove_subscriber(sub);});
+    subscribers.erase(it);
 }
 
 void ctlr_mgr::add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys)
 {
-    std::unique_ptr<virt_ctlr_passthrough> passthrough(new virt_ctlr_passthrough(phys));
+    std::unique_ptr<virt_ctlr_passthrough> passthrough(new virt_ctlr_passthrough(phys, epoll_manager));
+
+    subscribe_phys_ctlr(phys, passthrough.get());
+    // Other processes read it directly now
+    phys->set_event_mask(phys_ctlr::EventMask::None);
 
     if (left == phys)
         left = nullptr;
@@ -77,14 +166,14 @@ void ctlr_mgr::add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys)
     for (unsigned int i = 0; i < paired_controllers.size(); i++) {
         if (!paired_controllers[i]) {
             found_slot = true;
-            phys->set_player_leds_to_player(i % 4 + 1);
+            set_phys_leds(phys, i % 4 + 1);
             paired_controllers[i] = std::move(passthrough);
             break;
         }
     }
 
     if (!found_slot) {
-        phys->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
+        set_phys_leds(phys, paired_controllers.size() % 4 + 1);
         paired_controllers.push_back(std::move(passthrough));
     }
 
@@ -93,25 +182,33 @@ void ctlr_mgr::add_passthrough_ctlr(std::shared_ptr<phys_ctlr> phys)
 
 void ctlr_mgr::add_combined_ctlr()
 {
-    std::unique_ptr<virt_ctlr_combined> combined(new virt_ctlr_combined(left, right, epoll_manager));
+    worker_thread *worker = pick_worker();
+    std::unique_ptr<virt_ctlr_combined> combined;
+
+    run_on(worker, [&](){
+        combined.reset(new virt_ctlr_combined(left, right, epoll_of(worker), ff_worker, remaps, config, metrics));
+    });
+    owners[combined.get()] = worker;
 
     std::cout << "Creating combined joy-con input\n";
+    subscribe_phys_ctlr(left, combined.get());
+    subscribe_phys_ctlr(right, combined.get());
 
     bool found_slot = false;
     for (unsigned int i = 0; i < paired_controllers.size(); i++) {
         if (!paired_controllers[i]) {
             found_slot = true;
-            left->set_player_leds_to_player(i % 4 + 1);
-            right->set_player_leds_to_player(i % 4 + 1);
-            combined->set_player_leds_to_player(i % 4 + 1);
+            set_phys_leds(left, i % 4 + 1);
+            set_phys_leds(right, i % 4 + 1);
+            run_on(worker, [&](){combined->set_player_leds_to_player(i % 4 + 1);});
             paired_controllers[i] = std::move(combined);
             break;
         }
     }
     if (!found_slot) {
-        left->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        right->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        combined->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
+        set_phys_leds(left, paired_controllers.size() % 4 + 1);
+        set_phys_leds(right, paired_controllers.size() % 4 + 1);
+        run_on(worker, [&](){combined->set_player_leds_to_player(paired_controllers.size() % 4 + 1);});
         paired_controllers.push_back(std::move(combined));
     }
 
@@ -121,59 +218,86 @@ void ctlr_mgr::add_combined_ctlr()
 
 void ctlr_mgr::add_virt_procon_ctlr(std::shared_ptr<phys_ctlr> phys)
 {
-    std::unique_ptr<virt_ctlr_pro> procon(new virt_ctlr_pro(phys, epoll_manager));
+    worker_thread *worker = pick_worker();
+    std::unique_ptr<virt_ctlr_pro> procon;
+
+    run_on(worker, [&](){
+        procon.reset(new virt_ctlr_pro(phys, epoll_of(worker), ff_worker, remaps, config, metrics));
+    });
+    owners[procon.get()] = worker;
 
     std::cout << "Creating virtual pro controller input\n";
+    subscribe_phys_ctlr(phys, procon.get());
 
     bool found_slot = false;
     for (unsigned int i = 0; i < paired_controllers.size(); i++) {
         if (!paired_controllers[i]) {
             found_slot = true;
-            phys->set_player_leds_to_player(i % 4 + 1);
-            procon->set_player_leds_to_player(i % 4 + 1);
+            set_phys_leds(phys, i % 4 + 1);
+            run_on(worker, [&](){procon->set_player_leds_to_player(i % 4 + 1);});
             paired_controllers[i] = std::move(procon);
             break;
         }
     }
     if (!found_slot) {
-        phys->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
-        procon->set_player_leds_to_player(paired_controllers.size() % 4 + 1);
+        set_phys_leds(phys, paired_controllers.size() % 4 + 1);
+        run_on(worker, [&](){procon->set_player_leds_to_player(paired_controllers.size() % 4 + 1);});
         paired_controllers.push_back(std::move(procon));
     }
 
     unpaired_controllers.erase(phys->get_devpath());
 }
 
-//public
-ctlr_mgr::ctlr_mgr(epoll_mgr& epoll_manager) :
-    epoll_manager(epoll_manager),
-    unpaired_controllers(),
-    subscribers(),
-    paired_controllers()
+void ctlr_mgr::hand_off(struct handoff&& handoff)
 {
+    uint64_t one = 1;
+
+    // The relay thread drains the queue on every wakeup, so a full queue only lasts a moment
+    while (!handoffs.push(std::move(handoff)))
+        std::this_thread::yield();
+    if (write(handoff_fd, &one, sizeof(one)) != sizeof(one))
+        std::cerr << "Failed to signal controller handoff\n";
 }
 
-ctlr_mgr::~ctlr_mgr()
+void ctlr_mgr::handle_handoffs()
 {
+    struct handoff handoff;
+    uint64_t count;
+
+    if (read(handoff_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        std::cerr << "Failed to read controller handoff eventfd; " << strerror(errno) << std::endl;
 
+    while (handoffs.pop(handoff)) {
+        if (handoff.phys)
+            pair_ctlr(handoff.phys);
+        else
+            unpair_ctlr(handoff.devpath);
+    }
 }
 
-void ctlr_mgr::add_ctlr(const std::string& devpath, const std::string& devname)
+void ctlr_mgr::set_phys_leds(std::shared_ptr<phys_ctlr> phys, int player)
 {
-    std::shared_ptr<phys_ctlr> phys = nullptr;
-
-    if (!unpaired_controllers.count(devpath)) {
-        std::cout << "Creating new phys_ctlr for " << devname << std::endl;
-        phys.reset(new phys_ctlr(devpath, devname));
-        unpaired_controllers[devpath] = phys;
-        phys->blink_player_leds();
-        subscribers[devpath] = std::make_shared<epoll_subscriber>(std::vector({phys->get_fd()}),
-                                                [=](int event_fd){epoll_event_callback(event_fd);});
-        epoll_manager.add_subscriber(subscribers[devpath]);
-    } else {
-        std::cerr << "Attempting to add existing phys_ctlr to controller manager\n";
-        return;
+    control.post([phys, player](){phys->set_player_leds_to_player(player);});
+}
+
+// The latency request is only held while some controller is paired
+void ctlr_mgr::update_cpu_latency()
+{
+    bool any_paired = false;
+
+    for (auto& ctlr : paired_controllers) {
+        if (ctlr)
+            any_paired = true;
     }
+    cpu_latency.set_active(any_paired);
+}
+
+void ctlr_mgr::pair_ctlr(std::shared_ptr<phys_ctlr> phys)
+{
+    std::string const devpath = phys->get_devpath();
+
+    unpaired_controllers[devpath] = phys;
+    subscribe_phys_ctlr(phys, nullptr);
 
     // See if this controller belongs to a "stale" controller
     for (unsigned int i = 0; i < stale_controllers.size(); i++) {
@@ -207,17 +331,15 @@ void ctlr_mgr::add_ctlr(const std::string& devpath, const std::string& devname)
             continue;
 
         if (virt->supports_hotplug()) {
-            bool found;
+            bool found = false;
             for (auto phys2 : virt->get_phys_ctlrs()) {
                 if (phys->get_mac_addr() == phys2->get_mac_addr() && phys->get_mac_addr() != "") {
                     std::cout << "Replacing controller (likely a BT to serial switch)\n";
-                    if (subscribers.count(phys2->get_devpath())) {
-                        epoll_manager.remove_subscriber(subscribers[phys2->get_devpath()]);
-                        subscribers.erase(phys2->get_devpath());
-                    }
-                    virt->remove_phys_ctlr(phys2);
-                    phys->set_player_leds_to_player(i % 4 + 1);
-                    virt->add_phys_ctlr(phys);
+                    unsubscribe_phys_ctlr(phys2->get_devpath());
+                    run_on(worker_of(virt.get()), [&](){virt->remove_phys_ctlr(phys2);});
+                    set_phys_leds(phys, i % 4 + 1);
+                    run_on(worker_of(virt.get()), [&](){virt->add_phys_ctlr(phys);});
+                    subscribe_phys_ctlr(phys, virt.get());
                     unpaired_controllers.erase(phys->get_devpath());
                     found = true;
                     break;
@@ -232,28 +354,28 @@ void ctlr_mgr::add_ctlr(const std::string& devpath, const std::string& devname)
     for (unsigned int i = 0; i < paired_controllers.size(); i++) {
         auto& virt = paired_controllers[i];
 
-        if (!virt)
+        if (!virt || !unpaired_controllers.count(devpath))
             continue;
 
         if (((virt->needs_model() == phys->get_model() && phys->get_model() != phys_ctlr::Model::Unknown)
             || virt->no_ctlrs_left()) && virt->supports_hotplug()) {
             std::cout << "Detected reconnected joy-con\n";
-            phys->set_player_leds_to_player(i % 4 + 1);
-            virt->add_phys_ctlr(phys);
+            set_phys_leds(phys, i % 4 + 1);
+            run_on(worker_of(virt.get()), [&](){virt->add_phys_ctlr(phys);});
+            subscribe_phys_ctlr(phys, virt.get());
             unpaired_controllers.erase(phys->get_devpath());
+            break;
         }
     }
     // check if we're already ready to pair this contoller
     if (unpaired_controllers.count(devpath))
-        epoll_event_callback(unpaired_controllers[devpath]->get_fd());
+        handle_pairing_events(phys);
+    update_cpu_latency();
 }
 
-void ctlr_mgr::remove_ctlr(const std::string& devpath)
+void ctlr_mgr::unpair_ctlr(const std::string& devpath)
 {
-    if (subscribers.count(devpath)) {
-        epoll_manager.remove_subscriber(subscribers[devpath]);
-        subscribers.erase(devpath);
-    }
+    unsubscribe_phys_ctlr(devpath);
     if (unpaired_controllers.count(devpath)) {
         std::cout << "Removing " << devpath << " from unpaired list\n";
         auto phys = unpaired_controllers[devpath];
@@ -272,7 +394,7 @@ void ctlr_mgr::remove_ctlr(const std::string& devpath)
                 bool serial = phys->is_serial_ctlr();
 
                 if (ctlr->supports_hotplug())
-                    ctlr->remove_phys_ctlr(phys);
+                    run_on(worker_of(ctlr.get()), [&](){ctlr->remove_phys_ctlr(phys);});
 
                 if (ctlr->no_ctlrs_left()) {
                     if (serial) {
@@ -280,6 +402,7 @@ void ctlr_mgr::remove_ctlr(const std::string& devpath)
                         stale_controllers.push_back(std::move(ctlr));
                     } else {
                         std::cout << "unpairing controller\n";
+                        destroy_virt_ctlr(ctlr);
                     }
                     ctlr = nullptr;
                 }
@@ -291,4 +414,102 @@ void ctlr_mgr::remove_ctlr(const std::string& devpath)
         if (found)
             break;
     }
+    update_cpu_latency();
+}
+
+//public
+ctlr_mgr::ctlr_mgr(epoll_mgr& epoll_manager, worker_thread& control, const joycond_config& config,
+                   metrics_registry& metrics) :
+    epoll_manager(epoll_manager),
+    control(control),
+    config(config),
+    metrics(metrics),
+    workers(),
+    owners(),
+    ff_worker("ff", -1, metrics),
+    cpu_latency(epoll_manager, config, metrics),
+    remaps(),
+    unpaired_controllers(),
+    subscribers(),
+    paired_controllers(),
+    known_ctlrs(),
+    handoffs(),
+    handoff_fd(-1),
+    handoff_subscriber(nullptr)
+{
+    remaps.load(config.remap_dir);
+
+    handoff_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (handoff_fd < 0) {
+        std::cerr << "Failed to create controller handoff eventfd; " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    handoff_subscriber = std::make_shared<epoll_subscriber>(std::vector({handoff_fd}),
+                                                            [=](int event_fd){handle_handoffs();},
+                                                            "handoff");
+    epoll_manager.add_subscriber(handoff_subscriber);
+    epoll_manager.set_busy_poll_budget(config.busy_poll_budget);
+
+    for (unsigned int i = 0; i < config.workers; i++) {
+        int cpu = config.pin_cpus.empty() ? -1 : config.pin_cpus[i % config.pin_cpus.size()];
+        workers.emplace_back(new worker_thread("relay" + std::to_string(i), cpu, metrics,
+                                              config.io_uring ? epoll_mgr::Backend::Io_Uring
+                                                              : epoll_mgr::Backend::Epoll,
+                                              config.realtime_priority));
+        worker_thread *worker = workers.back().get();
+        worker->run_sync([&](){worker->get_epoll_mgr().set_busy_poll_budget(config.busy_poll_budget);});
+    }
+}
+
+ctlr_mgr::~ctlr_mgr()
+{
+    // Virtual controllers have to be torn down on their own threads before those threads exit
+    for (auto& ctlr : paired_controllers) {
+        if (ctlr)
+            destroy_virt_ctlr(ctlr);
+    }
+    for (auto& ctlr : stale_controllers) {
+        if (ctlr)
+            destroy_virt_ctlr(ctlr);
+    }
+    while (!subscribers.empty())
+        unsubscribe_phys_ctlr(std::string(subscribers.begin()->first));
+    epoll_manager.remove_subscriber(handoff_subscriber);
+    close(handoff_fd);
+}
+
+// Runs on the control thread; the relay thread picks the controller up in handle_handoffs()
+void ctlr_mgr::add_ctlr(const std::string& devpath, const std::string& devname)
+{
+    if (known_ctlrs.count(devpath)) {
+        std::cerr << "Attempting to add existing phys_ctlr to controller manager\n";
+        return;
+    }
+
+    std::cout << "Creating new phys_ctlr for " << devname << std::endl;
+    // LEDs and their retry timers belong to the control thread, so that's where phys_ctlrs die too
+    worker_thread *owner = &control;
+    std::shared_ptr<phys_ctlr> phys(new phys_ctlr(devpath, devname, control.get_epoll_mgr(), config, metrics),
+                                    [owner](phys_ctlr *ctlr){owner->post([ctlr](){delete ctlr;});});
+    known_ctlrs[devpath] = phys;
+    phys->blink_player_leds();
+    hand_off({devpath, phys});
+}
+
+// Runs on the control thread
+void ctlr_mgr::remove_ctlr(const std::string& devpath)
+{
+    known_ctlrs.erase(devpath);
+    hand_off({devpath, nullptr});
+}
+
+// Runs on the control thread
+void ctlr_mgr::add_led(const std::string& syspath)
+{
+    for (auto& kv : known_ctlrs) {
+        std::shared_ptr<phys_ctlr> phys = kv.second.lock();
+
+        if (phys && phys->attach_led(syspath))
+            return;
+    }
 }
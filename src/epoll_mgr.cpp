@@ -1,37 +1,330 @@
 #include "epoll_mgr.h"
+#include "realtime.h"
 
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// How often a realtime loop checks its relay path for allocations and page faults
+static const uint64_t REALTIME_CHECK_NS = 1000000000ULL;
+
+// Deferred turns in a row after which an endpoint is reported as flooding
+static const unsigned int FLOOD_TURNS = 1000;
+
+// Busy polling budgets are accounted over periods this long
+static const uint64_t BUSY_POLL_PERIOD_NS = 100000000ULL;
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
 
 //private
+void epoll_mgr::arm_timer_fd()
+{
+    std::optional<uint64_t> next = timers.next_expiry();
+    uint64_t expiry = next.value_or(0);
+
+    if (expiry == armed_ns)
+        return;
+
+    // An absolute expiry already in the past fires immediately, which is what an overdue timer wants
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+    if (next) {
+        spec.it_value.tv_sec = expiry / 1000000000ULL;
+        spec.it_value.tv_nsec = expiry % 1000000000ULL;
+        if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+            spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL)) {
+        std::cerr << "Failed to arm timerfd; " << strerror(errno) << std::endl;
+        return;
+    }
+    armed_ns = expiry;
+}
+
+void epoll_mgr::handle_timers()
+{
+    uint64_t expirations;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        std::cerr << "Failed to read timerfd; " << strerror(errno) << std::endl;
+    armed_ns = 0;
+
+    timers.expire(now_ns(), firing);
+    // Callbacks may add or cancel timers, including ones later in this batch
+    for (size_t i = 0; i < firing.size(); i++) {
+        std::function<void()> callback = std::move(firing[i].callback);
+        if (callback)
+            callback();
+    }
+    firing.clear();
+    arm_timer_fd();
+}
+
+// Runs one subscriber callback and charges it from start_ns; returns when it finished
+uint64_t epoll_mgr::dispatch(struct epoll_endpoint *endpoint, uint64_t start_ns)
+{
+    auto sub = endpoint->subscriber;
+    if (!sub->is_active())
+        return start_ns;
+
+    current = endpoint;
+    if (sub->is_relay()) {
+        realtime_section section;
+        (*sub)(endpoint->fd);
+    } else {
+        (*sub)(endpoint->fd);
+    }
+    current = nullptr;
+    if (!endpoint->deferred)
+        endpoint->deferred_turns = 0;
+    uint64_t end_ns = now_ns();
+    sub->get_stats()->calls.add();
+    sub->get_stats()->ns.add(end_ns - start_ns);
+    return end_ns;
+}
+
+// One more turn for every endpoint deferred so far; ones deferring again wait for the next turn
+uint64_t epoll_mgr::dispatch_deferred(uint64_t start_ns)
+{
+    if (deferred.empty())
+        return start_ns;
+
+    loop_stats.deferred_turns.add();
+    deferred_turn.swap(deferred);
+    for (auto endpoint : deferred_turn) {
+        endpoint->deferred = false;
+        start_ns = dispatch(endpoint, start_ns);
+    }
+    deferred_turn.clear();
+    return start_ns;
+}
+
+// Starts a busy polling turn if anything is hot and the budget allows; returns its start or 0
+uint64_t epoll_mgr::busy_poll_turn()
+{
+    if (hot.empty())
+        return 0;
+
+    uint64_t turn_ns = now_ns();
+    if (turn_ns - busy_poll_period_start >= BUSY_POLL_PERIOD_NS) {
+        busy_poll_period_start = turn_ns;
+        busy_poll_spent_ns = 0;
+    }
+    if (busy_poll_spent_ns >= busy_poll_budget_ns) {
+        loop_stats.busy_poll_throttled.add();
+        cool_hot();
+        return 0;
+    }
+    return turn_ns;
+}
+
+// Reads every hot endpoint once and charges the turn, wait included, to the busy polling budget
+void epoll_mgr::dispatch_hot(uint64_t turn_ns, uint64_t start_ns)
+{
+    // Callbacks make endpoints hot again, so the ones still in their window are collected anew
+    hot_turn.swap(hot);
+    for (auto endpoint : hot_turn) {
+        uint64_t hot_until = endpoint->hot_until;
+        // Cooled by remove_subscriber() or throttling earlier in this turn
+        if (!hot_until)
+            continue;
+        if (start_ns >= hot_until) {
+            endpoint->hot_until = 0;
+            continue;
+        }
+        hot.push_back(endpoint);
+        // Gets its turn with the deferred ones
+        if (endpoint->deferred)
+            continue;
+
+        // What the callback reads now was dequeued now, not at the wakeup
+        wakeup_ns = start_ns;
+        start_ns = dispatch(endpoint, start_ns);
+        if (endpoint->hot_until != hot_until) {
+            loop_stats.busy_poll_hits.add();
+#ifdef HAVE_IO_URING
+            // Don't hold the frame it relayed until the next wait
+            if (uring)
+                uring_submit();
+#endif
+        }
+    }
+    hot_turn.clear();
+
+    busy_poll_spent_ns += start_ns - turn_ns;
+    loop_stats.busy_poll_ns.add(start_ns - turn_ns);
+    if (busy_poll_spent_ns >= busy_poll_budget_ns) {
+        loop_stats.busy_poll_throttled.add();
+        cool_hot();
+    }
+}
+
+void epoll_mgr::cool_hot()
+{
+    for (auto endpoint : hot)
+        endpoint->hot_until = 0;
+    hot.clear();
+}
+
+struct epoll_endpoint *epoll_mgr::find_endpoint(int fd)
+{
+    auto it = subscribers.find(fd);
+    if (it == subscribers.end())
+        return nullptr;
+
+    for (auto& endpoint : it->second->get_endpoints()) {
+        if (endpoint.fd == fd)
+            return &endpoint;
+    }
+    return nullptr;
+}
+
+void epoll_mgr::defer_endpoint(struct epoll_endpoint *endpoint)
+{
+    if (endpoint->deferred || !endpoint->subscriber->is_active())
+        return;
+
+    endpoint->deferred = true;
+    deferred.push_back(endpoint);
+    endpoint->subscriber->get_stats()->deferrals.add();
+    if (++endpoint->deferred_turns == FLOOD_TURNS)
+        std::cerr << "fd=" << endpoint->fd << " (" << endpoint->subscriber->get_name() << ") has had more input than "
+                  << "its budget for " << FLOOD_TURNS << " turns in a row\n";
+}
+
+void epoll_mgr::check_realtime()
+{
+    struct rusage usage;
+    uint64_t allocations = realtime_allocations();
+
+    if (allocations != realtime_allocs_seen) {
+        std::cerr << realtime_name << ": " << allocations - realtime_allocs_seen
+                  << " heap allocations on the relay path\n";
+        loop_stats.relay_allocations.add(allocations - realtime_allocs_seen);
+        realtime_allocs_seen = allocations;
+    }
+
+    // Counts every fault on the thread; the relay callbacks are what normally runs here
+    if (!getrusage(RUSAGE_THREAD, &usage)) {
+        uint64_t faults = usage.ru_minflt + usage.ru_majflt;
+        if (faults != realtime_faults_seen) {
+            std::cerr << realtime_name << ": " << faults - realtime_faults_seen
+                      << " page faults on the relay thread\n";
+            loop_stats.relay_page_faults.add(faults - realtime_faults_seen);
+            realtime_faults_seen = faults;
+        }
+    }
+
+    realtime_timer = add_timer(REALTIME_CHECK_NS, [=](){check_realtime();});
+}
 
 //public
-epoll_mgr::epoll_mgr()
+epoll_mgr::epoll_mgr(enum Backend backend) :
+    backend(backend),
+    epoll_fd(-1),
+    uring(nullptr),
+    subscribers(),
+    removed_subscribers(),
+    wakeup_ns(0),
+    current(nullptr),
+    deferred(),
+    deferred_turn(),
+    hot(),
+    hot_turn(),
+    timer_fd(-1),
+    timer_subscriber(nullptr),
+    timers(),
+    armed_ns(0),
+    firing(),
+    loop_stats(),
+    stats_lock(),
+    callback_stats(),
+    realtime_name(),
+    realtime_timer(0),
+    realtime_allocs_seen(0),
+    realtime_faults_seen(0),
+    busy_poll_budget_ns(0),
+    busy_poll_period_start(0),
+    busy_poll_spent_ns(0)
 {
-    epoll_fd = epoll_create1(0);
-    if (epoll_fd < 0) {
-        std::cerr << "Failed to create epoll; " << strerror(errno) << std::endl;
+#ifdef HAVE_IO_URING
+    if (backend == Backend::Io_Uring)
+        uring_init();
+#else
+    if (backend == Backend::Io_Uring) {
+        std::cerr << "joycond was built without io_uring support\n";
+        exit(EXIT_FAILURE);
+    }
+#endif
+    if (backend == Backend::Epoll) {
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd < 0) {
+            std::cerr << "Failed to create epoll; " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        std::cerr << "Failed to create timerfd; " << strerror(errno) << std::endl;
         exit(EXIT_FAILURE);
     }
+    firing.reserve(16);
+    deferred.reserve(16);
+    deferred_turn.reserve(16);
+    hot.reserve(16);
+    hot_turn.reserve(16);
+    timer_subscriber = std::make_shared<epoll_subscriber>(std::vector({timer_fd}),
+                                                          [=](int event_fd){handle_timers();},
+                                                          "timer");
+    add_subscriber(timer_subscriber);
 }
 
 epoll_mgr::~epoll_mgr()
 {
+    if (realtime_timer)
+        cancel_timer(realtime_timer);
+    remove_subscriber(timer_subscriber);
+    close(timer_fd);
+#ifdef HAVE_IO_URING
+    if (uring)
+        uring_exit();
+#endif
+    if (epoll_fd >= 0)
+        close(epoll_fd);
 }
 
 void epoll_mgr::add_subscriber(std::shared_ptr<epoll_subscriber> sub)
 {
-    for (int fd : sub->get_event_fds()) {
+    for (auto& endpoint : sub->get_endpoints()) {
+        int fd = endpoint.fd;
         if (subscribers.count(fd)) {
             std::cerr << "epoll_mgr already contains event_fd; cannot add twice\n";
             exit(EXIT_FAILURE);
         }
 
+#ifdef HAVE_IO_URING
+        if (uring) {
+            uring_add(endpoint, sub);
+            std::cout << "adding epoll_subscriber: fd=" << fd << std::endl;
+            subscribers[fd] = sub;
+            continue;
+        }
+#endif
         struct epoll_event event = {0};
         event.events = EPOLLIN;
-        event.data.fd = fd;
+        event.data.ptr = &endpoint;
         if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
             std::cerr << "Failed to add fd to epoll; errno=" << errno << std::endl;
             exit(EXIT_FAILURE);
@@ -39,50 +332,238 @@ void epoll_mgr::add_subscriber(std::shared_ptr<epoll_subscriber> sub)
         std::cout << "adding epoll_subscriber: fd=" << fd << std::endl;
         subscribers[fd] = sub;
     }
+
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        auto& stats = callback_stats[sub->get_name()];
+        if (!stats)
+            stats.reset(new struct callback_stats());
+        sub->set_stats(stats.get());
+    }
+    sub->set_active(true);
 }
 
 void epoll_mgr::remove_subscriber(std::shared_ptr<epoll_subscriber> sub)
 {
-    for (int fd : sub->get_event_fds()) {
-        if (!subscribers.count(fd)) {
+    for (auto& endpoint : sub->get_endpoints()) {
+        int fd = endpoint.fd;
+        auto it = subscribers.find(fd);
+        if (it == subscribers.end()) {
             std::cerr << "epoll_mgr doesn't contain event_fd; cannot remove: " << fd << std::endl;
             exit(EXIT_FAILURE);
         }
-        if (subscribers[fd] != sub) {
+        if (it->second != sub) {
             std::cerr << "subscriber to be removed matches fd of other subscriber\n";
             exit(EXIT_FAILURE);
         }
 
+#ifdef HAVE_IO_URING
+        if (uring) {
+            uring_remove(endpoint);
+            subscribers.erase(it);
+            continue;
+        }
+#endif
         struct epoll_event event = {0};
         event.events = EPOLLIN;
-        event.data.fd = fd;
         if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &event)) {
             std::cerr << "Failed to remove fd from epoll; errno=" << errno << std::endl;
             exit(EXIT_FAILURE);
         }
-        subscribers.erase(fd);
+        subscribers.erase(it);
+    }
+
+    // Events for this subscriber may still be pending in the batch being dispatched, but deferred
+    // endpoints outlive the batch
+    deferred.erase(std::remove_if(deferred.begin(), deferred.end(),
+                                  [&](struct epoll_endpoint *endpoint){return endpoint->subscriber == sub.get();}),
+                   deferred.end());
+    hot.erase(std::remove_if(hot.begin(), hot.end(),
+                             [&](struct epoll_endpoint *endpoint){return endpoint->subscriber == sub.get();}),
+              hot.end());
+    for (auto& endpoint : sub->get_endpoints())
+        endpoint.hot_until = 0;
+    sub->set_active(false);
+    removed_subscribers.push_back(sub);
+    // Its owner closes the fds next, and a queued write must not reach whatever reuses the number
+    flush_writes();
+}
+
+epoll_mgr::timer_id epoll_mgr::add_timer(uint64_t delay_ns, std::function<void()> callback)
+{
+    uint64_t expiry = now_ns() + delay_ns;
+    timer_id id = timers.add(expiry, callback);
+
+    // Earlier timers are already armed for; a later one is picked up when the timerfd fires
+    if (!armed_ns || expiry < armed_ns)
+        arm_timer_fd();
+    return id;
+}
+
+void epoll_mgr::cancel_timer(timer_id id)
+{
+    // A stale timerfd expiry just causes one empty wakeup, so it isn't rearmed here
+    if (timers.cancel(id))
+        return;
+    for (auto& timer : firing) {
+        if (timer.id == id)
+            timer.callback = nullptr;
     }
 }
 
 static const int MAX_EVENTS = 10;
-static const int TIMEOUT = 500;
+// Nothing needs polling; delayed work goes through the timer wheel, so idle means asleep
+static const int TIMEOUT = -1;
 void epoll_mgr::loop()
 {
     struct epoll_event events[MAX_EVENTS];
     int nfds;
 
-    nfds = epoll_pwait(epoll_fd, events, MAX_EVENTS, TIMEOUT, nullptr);
+#ifdef HAVE_IO_URING
+    if (uring) {
+        uring_loop();
+        removed_subscribers.clear();
+        return;
+    }
+#endif
+
+    // With deferred work pending or fds to busy poll, only check for what else became ready
+    uint64_t busy_poll_ns = busy_poll_turn();
+    bool blocking = deferred.empty() && !busy_poll_ns;
+    loop_stats.syscalls.add();
+    nfds = epoll_pwait(epoll_fd, events, MAX_EVENTS, blocking ? TIMEOUT : 0, nullptr);
     if (nfds == -1) {
         std::cerr << "epoll_pwait failure\n";
         return;
     }
+    wakeup_ns = now_ns();
+    loop_stats.wakeups.add();
+    if (!nfds && blocking)
+        loop_stats.timeouts.add();
 
+    // Each callback is charged from the end of the previous one, costing one clock read per dispatch
+    uint64_t start_ns = wakeup_ns;
     for (int i = 0; i < nfds; i++) {
-        int e_fd = events[i].data.fd;
-        if (subscribers.count(e_fd))
-            (*subscribers[e_fd])(e_fd);
-        else
-            std::cerr << "fd not found in subscribers map\n";
+        auto endpoint = static_cast<struct epoll_endpoint *>(events[i].data.ptr);
+        // Already queued for this turn, behind everyone else
+        if (endpoint->deferred)
+            continue;
+        start_ns = dispatch(endpoint, start_ns);
+    }
+    start_ns = dispatch_deferred(start_ns);
+    if (busy_poll_ns)
+        dispatch_hot(busy_poll_ns, start_ns);
+    removed_subscribers.clear();
+}
+
+ssize_t epoll_mgr::submit_write(int fd, const void *buf, size_t len)
+{
+#ifdef HAVE_IO_URING
+    if (uring && len <= MAX_QUEUED_WRITE) {
+        uring_write(fd, buf, len);
+        return len;
     }
+#endif
+    loop_stats.syscalls.add();
+    return write(fd, buf, len);
 }
 
+void epoll_mgr::flush_writes()
+{
+#ifdef HAVE_IO_URING
+    if (uring)
+        uring_flush();
+#endif
+}
+
+void epoll_mgr::set_realtime(int priority, std::string const &name)
+{
+    struct rusage usage;
+
+    realtime_enter_thread(priority);
+    realtime_name = name;
+    // Faults and allocations from before this point are startup, not violations
+    realtime_allocs_seen = realtime_allocations();
+    if (!getrusage(RUSAGE_THREAD, &usage))
+        realtime_faults_seen = usage.ru_minflt + usage.ru_majflt;
+    if (!realtime_timer)
+        realtime_timer = add_timer(REALTIME_CHECK_NS, [=](){check_realtime();});
+}
+
+void epoll_mgr::set_busy_poll_budget(unsigned int percent)
+{
+    busy_poll_budget_ns = BUSY_POLL_PERIOD_NS / 100 * percent;
+}
+
+void epoll_mgr::busy_poll(int fd, uint64_t window_ns)
+{
+    if (!busy_poll_budget_ns)
+        return;
+
+    struct epoll_endpoint *endpoint = find_endpoint(fd);
+    if (!endpoint || !endpoint->subscriber->is_active())
+        return;
+
+    // A window opened after the budget ran out would only be cooled again on the next turn
+    if (wakeup_ns - busy_poll_period_start < BUSY_POLL_PERIOD_NS && busy_poll_spent_ns >= busy_poll_budget_ns) {
+        loop_stats.busy_poll_throttled.add();
+        return;
+    }
+
+    if (!endpoint->hot_until) {
+        loop_stats.busy_polls.add();
+        hot.push_back(endpoint);
+    }
+    if (wakeup_ns + window_ns > endpoint->hot_until)
+        endpoint->hot_until = wakeup_ns + window_ns;
+}
+
+void epoll_mgr::defer_current()
+{
+    if (current)
+        defer_endpoint(current);
+}
+
+void epoll_mgr::defer(int fd)
+{
+    struct epoll_endpoint *endpoint = find_endpoint(fd);
+
+    if (endpoint)
+        defer_endpoint(endpoint);
+}
+
+void epoll_mgr::write_metrics(metrics_writer& writer, std::string const &labels)
+{
+    writer.counter("joycond_epoll_wakeups_total", "Returns from epoll_pwait", labels, loop_stats.wakeups.get());
+    writer.counter("joycond_epoll_timeouts_total", "Returns from epoll_pwait without any event", labels,
+                   loop_stats.timeouts.get());
+    writer.counter("joycond_loop_syscalls_total",
+                   "System calls made by the event loop to wait and to write uinput frames and FF events",
+                   labels, loop_stats.syscalls.get());
+    writer.counter("joycond_relay_allocations_total", "Heap allocations made by relay callbacks in --realtime mode",
+                   labels, loop_stats.relay_allocations.get());
+    writer.counter("joycond_relay_page_faults_total", "Page faults on relay threads in --realtime mode",
+                   labels, loop_stats.relay_page_faults.get());
+    writer.counter("joycond_busy_polls_total", "Busy poll windows opened after relaying input", labels,
+                   loop_stats.busy_polls.get());
+    writer.counter("joycond_busy_poll_hits_total", "Busy polled reads that returned input", labels,
+                   loop_stats.busy_poll_hits.get());
+    writer.counter("joycond_busy_poll_seconds_total", "Time spent busy polling", labels,
+                   loop_stats.busy_poll_ns.get() / 1e9);
+    writer.counter("joycond_busy_poll_throttled_total", "Busy polls cut short or skipped by the CPU budget",
+                   labels, loop_stats.busy_poll_throttled.get());
+    writer.counter("joycond_deferred_turns_total", "Loop turns that continued callbacks cut off by their event budget",
+                   labels, loop_stats.deferred_turns.get());
+
+    std::lock_guard<std::mutex> guard(stats_lock);
+    for (auto& kv : callback_stats) {
+        std::string callback_labels = labels + "," + metrics_writer::label("callback", kv.first);
+        writer.counter("joycond_callback_calls_total", "Dispatches to epoll callbacks", callback_labels,
+                       kv.second->calls.get());
+        writer.counter("joycond_callback_seconds_total", "Time spent in epoll callbacks", callback_labels,
+                       kv.second->ns.get() / 1e9);
+        writer.counter("joycond_callback_deferrals_total",
+                       "Times a callback hit its event budget and was requeued behind the other ready fds",
+                       callback_labels, kv.second->deferrals.get());
+    }
+}
@@ -0,0 +1,293 @@
+#include "epoll_mgr.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <liburing.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static const unsigned int QUEUE_DEPTH = 256;
+// Write buffers allocated up front, enough for the writes of a busy batch
+static const unsigned int PREALLOCATED_WRITES = 32;
+// Poll completions kept without allocating: a full completion queue plus some reaped while flushing
+static const unsigned int MAX_COMPLETIONS = 4 * QUEUE_DEPTH;
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+struct uring_req
+{
+    enum class Kind { Poll, Write } kind;
+};
+
+// Lives until the poll's final completion, which can come after the subscriber was removed, or
+// until removal once a failed poll was given up on
+struct uring_poll : uring_req
+{
+    struct epoll_endpoint *endpoint;
+    std::shared_ptr<epoll_subscriber> subscriber;
+    bool removed;
+    bool failed;
+};
+
+// The kernel may read the buffer any time before the completion, so it can't be the caller's
+struct uring_write : uring_req
+{
+    int fd;
+    size_t len;
+    char data[epoll_mgr::MAX_QUEUED_WRITE];
+};
+
+struct uring_completion
+{
+    struct uring_poll *poll;
+    int res;
+    unsigned int flags;
+};
+
+struct epoll_mgr::uring_state
+{
+    struct io_uring ring;
+    std::map<struct epoll_endpoint *, struct uring_poll *> polls;
+    // Cancelled polls waiting for their final completion
+    std::vector<struct uring_poll *> removed_polls;
+    std::vector<struct uring_write *> writes;
+    std::vector<struct uring_write *> free_writes;
+    unsigned int writes_in_flight;
+    // Poll completions not yet dispatched, and the ones being dispatched this turn
+    std::vector<struct uring_completion> completions;
+    std::vector<struct uring_completion> turn;
+
+    void finish_write(struct uring_write *write, int res);
+    void reap();
+};
+
+void epoll_mgr::uring_state::finish_write(struct uring_write *write, int res)
+{
+    if (res != (int)write->len)
+        std::cerr << "Queued write to fd=" << write->fd << " failed; ret=" << res << " "
+                  << (res < 0 ? strerror(-res) : "short write") << std::endl;
+    free_writes.push_back(write);
+    writes_in_flight--;
+}
+
+// Finishes completed writes and keeps poll completions for dispatch, since callbacks queue new SQEs
+void epoll_mgr::uring_state::reap()
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head;
+    unsigned int count = 0;
+
+    io_uring_for_each_cqe(&ring, head, cqe) {
+        struct uring_req *req = static_cast<struct uring_req *>(io_uring_cqe_get_data(cqe));
+        if (req && req->kind == uring_req::Kind::Write) {
+            finish_write(static_cast<struct uring_write *>(req), cqe->res);
+        } else if (req) {
+            completions.push_back({ static_cast<struct uring_poll *>(req), cqe->res, cqe->flags });
+        }
+        count++;
+    }
+    io_uring_cq_advance(&ring, count);
+}
+
+static struct io_uring_sqe *get_sqe(struct io_uring *ring)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+    // The submission queue is full; push it to the kernel early and take a fresh entry
+    if (!sqe) {
+        io_uring_submit(ring);
+        sqe = io_uring_get_sqe(ring);
+    }
+    return sqe;
+}
+
+static void arm_poll(struct io_uring *ring, struct uring_poll *poll)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+
+    io_uring_prep_poll_multishot(sqe, poll->endpoint->fd, POLLIN);
+    io_uring_sqe_set_data(sqe, poll);
+}
+
+//private
+void epoll_mgr::uring_init()
+{
+    uring = new struct uring_state();
+
+    int ret = io_uring_queue_init(QUEUE_DEPTH, &uring->ring, 0);
+    if (ret < 0) {
+        std::cerr << "Failed to set up io_uring; " << strerror(-ret) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Keeps the relay path from allocating write buffers while the pool warms up
+    uring->writes.reserve(PREALLOCATED_WRITES);
+    uring->free_writes.reserve(PREALLOCATED_WRITES);
+    for (unsigned int i = 0; i < PREALLOCATED_WRITES; i++) {
+        struct uring_write *write = new struct uring_write();
+        write->kind = uring_req::Kind::Write;
+        uring->writes.push_back(write);
+        uring->free_writes.push_back(write);
+    }
+    uring->writes_in_flight = 0;
+    uring->completions.reserve(MAX_COMPLETIONS);
+    uring->turn.reserve(MAX_COMPLETIONS);
+}
+
+void epoll_mgr::uring_exit()
+{
+    // Queued writes still go out; whatever else is in flight is cancelled with the ring
+    uring_flush();
+    io_uring_queue_exit(&uring->ring);
+    for (auto& kv : uring->polls)
+        delete kv.second;
+    for (auto poll : uring->removed_polls)
+        delete poll;
+    for (auto write : uring->writes)
+        delete write;
+    delete uring;
+    uring = nullptr;
+}
+
+void epoll_mgr::uring_add(struct epoll_endpoint& endpoint, std::shared_ptr<epoll_subscriber> sub)
+{
+    struct uring_poll *poll = new struct uring_poll();
+
+    poll->kind = uring_req::Kind::Poll;
+    poll->endpoint = &endpoint;
+    poll->subscriber = sub;
+    poll->removed = false;
+    poll->failed = false;
+    uring->polls[&endpoint] = poll;
+    arm_poll(&uring->ring, poll);
+}
+
+void epoll_mgr::uring_remove(struct epoll_endpoint& endpoint)
+{
+    auto it = uring->polls.find(&endpoint);
+    if (it == uring->polls.end())
+        return;
+
+    // Nothing left in the kernel to cancel
+    if (it->second->failed) {
+        delete it->second;
+        uring->polls.erase(it);
+        return;
+    }
+
+    struct io_uring_sqe *sqe = get_sqe(&uring->ring);
+    io_uring_prep_poll_remove(sqe, (uint64_t)(uintptr_t)it->second);
+    io_uring_sqe_set_data(sqe, nullptr);
+
+    it->second->removed = true;
+    uring->removed_polls.push_back(it->second);
+    uring->polls.erase(it);
+}
+
+void epoll_mgr::uring_write(int fd, const void *buf, size_t len)
+{
+    struct uring_write *write;
+
+    if (uring->free_writes.empty()) {
+        write = new struct uring_write();
+        write->kind = uring_req::Kind::Write;
+        uring->writes.push_back(write);
+    } else {
+        write = uring->free_writes.back();
+        uring->free_writes.pop_back();
+    }
+    write->fd = fd;
+    write->len = len;
+    memcpy(write->data, buf, len);
+
+    struct io_uring_sqe *sqe = get_sqe(&uring->ring);
+    io_uring_prep_write(sqe, fd, write->data, len, 0);
+    io_uring_sqe_set_data(sqe, write);
+    uring->writes_in_flight++;
+}
+
+void epoll_mgr::uring_submit()
+{
+    if (!io_uring_sq_ready(&uring->ring))
+        return;
+
+    loop_stats.syscalls.add();
+    int ret = io_uring_submit(&uring->ring);
+    if (ret < 0)
+        std::cerr << "io_uring_submit failure; " << strerror(-ret) << std::endl;
+}
+
+// Poll completions that arrive meanwhile are dispatched on the next loop turn
+void epoll_mgr::uring_flush()
+{
+    while (uring->writes_in_flight) {
+        loop_stats.syscalls.add();
+        int ret = io_uring_submit_and_wait(&uring->ring, 1);
+        if (ret < 0 && ret != -EINTR) {
+            std::cerr << "io_uring_submit_and_wait failure; " << strerror(-ret) << std::endl;
+            return;
+        }
+        uring->reap();
+    }
+}
+
+// Submits every write queued since the last call and waits for readiness in the same io_uring_enter()
+void epoll_mgr::uring_loop()
+{
+    // With deferred work pending, fds to busy poll or completions left from a flush, only pick up
+    // what else completed
+    uint64_t busy_poll_ns = busy_poll_turn();
+    bool blocking = deferred.empty() && !busy_poll_ns && uring->completions.empty();
+    loop_stats.syscalls.add();
+    int ret = io_uring_submit_and_wait(&uring->ring, blocking ? 1 : 0);
+    if (ret < 0 && ret != -EINTR) {
+        std::cerr << "io_uring_submit_and_wait failure; " << strerror(-ret) << std::endl;
+        return;
+    }
+    wakeup_ns = now_ns();
+    loop_stats.wakeups.add();
+
+    uring->reap();
+    if (uring->completions.empty() && blocking)
+        loop_stats.timeouts.add();
+
+    // A callback flushing writes reaps into completions, for the next turn
+    uring->turn.swap(uring->completions);
+    uint64_t start_ns = wakeup_ns;
+    for (auto& done : uring->turn) {
+        struct uring_poll *poll = done.poll;
+        if (!(done.flags & IORING_CQE_F_MORE)) {
+            // The multishot poll ended: it was cancelled, or the kernel dropped it and it needs rearming
+            if (poll->removed) {
+                auto& removed = uring->removed_polls;
+                removed.erase(std::remove(removed.begin(), removed.end(), poll), removed.end());
+                delete poll;
+                continue;
+            }
+            // Rearming a poll the kernel refused, on a closed fd for one, would only fail again
+            if (done.res < 0) {
+                std::cerr << "Poll on fd=" << poll->endpoint->fd << " (" << poll->subscriber->get_name()
+                          << ") failed; " << strerror(-done.res) << std::endl;
+                poll->failed = true;
+                continue;
+            }
+            arm_poll(&uring->ring, poll);
+        }
+        // A deferred endpoint is already queued for this turn, behind everyone else
+        if (done.res > 0 && !poll->removed && !poll->endpoint->deferred)
+            start_ns = dispatch(poll->endpoint, start_ns);
+    }
+    uring->turn.clear();
+    start_ns = dispatch_deferred(start_ns);
+    if (busy_poll_ns)
+        dispatch_hot(busy_poll_ns, start_ns);
+}
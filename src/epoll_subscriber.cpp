@@ -3,10 +3,20 @@
 //private
 
 //public
-epoll_subscriber::epoll_subscriber(std::vector<int> fds, std::function<void(int event_fd)> callback) :
+epoll_subscriber::epoll_subscriber(std::vector<int> fds, std::function<void(int event_fd)> callback,
+                                   std::string const &name) :
     event_callback(callback),
-    event_fds(fds)
+    event_fds(fds),
+    endpoints(),
+    active(false),
+    relay(false),
+    name(name),
+    stats(nullptr)
 {
+    // The endpoint addresses are handed to the kernel, so the vector must never grow after this
+    endpoints.reserve(event_fds.size());
+    for (int fd : event_fds)
+        endpoints.push_back({this, fd, false, 0, 0});
 }
 
 epoll_subscriber::~epoll_subscriber()
@@ -0,0 +1,149 @@
+#include "ff_effect_table.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+//private
+struct ff_effect_table::slot *ff_effect_table::get(int id)
+{
+    if (id < 0 || (unsigned int)id >= slots.size() || !slots[id].used)
+        return nullptr;
+    return &slots[id];
+}
+
+//public
+ff_effect_table::ff_effect_table() :
+    slots(DEFAULT_EFFECTS)
+{
+}
+
+void ff_effect_table::size_from_device(char const *devnode)
+{
+    int max = -1;
+    int fd = devnode ? open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC) : -1;
+
+    if (fd >= 0) {
+        if (ioctl(fd, EVIOCGEFFECTS, &max) == -1)
+            max = -1;
+        close(fd);
+    }
+    if (max <= 0) {
+        std::cerr << "Failed to read ff_effects_max of " << (devnode ? devnode : "virtual controller")
+                  << "; assuming " << DEFAULT_EFFECTS << std::endl;
+        max = DEFAULT_EFFECTS;
+    }
+    slots.assign(max, slot());
+}
+
+int ff_effect_table::phys_id(int id, unsigned int side)
+{
+    struct slot *s = get(id);
+
+    if (!s || s->phys_id[side] < 0)
+        return NOT_UPLOADED;
+    return s->phys_id[side];
+}
+
+void ff_effect_table::store(int id, struct ff_effect const &effect, int16_t const phys_ids[MAX_SIDES])
+{
+    if (id < 0 || (unsigned int)id >= slots.size()) {
+        std::cerr << "ERROR: ff_effect id=" << id << " beyond ff_effects_max\n";
+        return;
+    }
+
+    struct slot &s = slots[id];
+    s.used = true;
+    s.generation++;
+    s.effect = effect;
+    for (unsigned int side = 0; side < MAX_SIDES; side++) {
+        s.phys_id[side] = phys_ids[side];
+        s.pending[side] = -1;
+    }
+}
+
+void ff_effect_table::erase(int id)
+{
+    struct slot *s = get(id);
+
+    if (!s)
+        return;
+    s->used = false;
+    s->generation++;
+}
+
+void ff_effect_table::forget_side(unsigned int side)
+{
+    for (auto& s : slots) {
+        s.phys_id[side] = NOT_UPLOADED;
+        s.pending[side] = -1;
+    }
+}
+
+bool ff_effect_table::play(struct input_event const &ev, unsigned int side, int fd, ff_pipeline& jobs,
+                           rumble_scheduler& rumble)
+{
+    struct slot *s = get(ev.code);
+
+    if (!s)
+        return false;
+
+    if (s->phys_id[side] >= 0) {
+        struct input_event redirected = ev;
+
+        redirected.code = s->phys_id[side];
+        rumble.queue(redirected);
+        return true;
+    }
+
+    // Only the latest play/stop matters once the upload is done
+    s->pending[side] = ev.value;
+    if (s->phys_id[side] == UPLOADING)
+        return true;
+    s->phys_id[side] = UPLOADING;
+
+    int id = ev.code;
+    uint32_t generation = s->generation;
+    struct ff_effect effect = s->effect;
+    effect.id = -1;
+    jobs.submit([this, id, side, fd, generation, effect, &jobs, &rumble]() mutable -> ff_pipeline::completion {
+        int err = ioctl(fd, EVIOCSFF, &effect) == -1 ? errno : 0;
+
+        return [this, id, side, fd, generation, effect, err, &jobs, &rumble]() {
+            struct slot *s = get(id);
+
+            if (err) {
+                std::cerr << "ERROR: Failed to reupload ff_effect: " << strerror(err) << std::endl;
+                if (s && s->generation == generation) {
+                    s->phys_id[side] = NOT_UPLOADED;
+                    s->pending[side] = -1;
+                }
+                return;
+            }
+
+            if (!s || s->generation != generation) {
+                // Erased or replaced by the game meanwhile; don't leave the copy behind on the device
+                int16_t orphan = effect.id;
+                jobs.submit([fd, orphan]() -> ff_pipeline::completion {
+                    ioctl(fd, EVIOCRMFF, orphan);
+                    return [](){};
+                });
+                return;
+            }
+
+            s->phys_id[side] = effect.id;
+            if (s->pending[side] >= 0) {
+                struct input_event play = { 0 };
+
+                play.type = EV_FF;
+                play.code = effect.id;
+                play.value = s->pending[side];
+                rumble.queue(play);
+                s->pending[side] = -1;
+            }
+        };
+    });
+    return true;
+}
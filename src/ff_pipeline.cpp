@@ -0,0 +1,73 @@
+#include "ff_pipeline.h"
+
+#include <cstring>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+//private
+void ff_pipeline::handle_done()
+{
+    std::vector<completion> batch;
+    uint64_t count;
+
+    if (read(done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        std::cerr << "Failed to read ff completion eventfd; " << strerror(errno) << std::endl;
+
+    {
+        std::lock_guard<std::mutex> guard(done_lock);
+        batch.swap(done);
+    }
+    for (auto& complete : batch)
+        complete();
+}
+
+//public
+ff_pipeline::ff_pipeline(epoll_mgr& epoll_manager, worker_thread& worker) :
+    epoll_manager(epoll_manager),
+    worker(worker),
+    done_fd(-1),
+    subscriber(nullptr),
+    done_lock(),
+    done()
+{
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done_fd < 0) {
+        std::cerr << "Failed to create ff completion eventfd; " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    subscriber = std::make_shared<epoll_subscriber>(std::vector({done_fd}),
+                                                    [=](int event_fd){handle_done();},
+                                                    "ff");
+    epoll_manager.add_subscriber(subscriber);
+}
+
+ff_pipeline::~ff_pipeline()
+{
+    // Jobs still queued on the worker point back at us
+    drain();
+    epoll_manager.remove_subscriber(subscriber);
+    close(done_fd);
+}
+
+void ff_pipeline::submit(std::function<completion()> job)
+{
+    worker.post([this, job](){
+        uint64_t one = 1;
+        completion complete = job();
+
+        {
+            std::lock_guard<std::mutex> guard(done_lock);
+            done.push_back(complete);
+        }
+        if (write(done_fd, &one, sizeof(one)) != sizeof(one))
+            std::cerr << "Failed to signal ff completion\n";
+    });
+}
+
+void ff_pipeline::drain()
+{
+    // The worker runs tasks in order, so once this one ran every earlier job has finished
+    worker.run_sync([](){});
+    handle_done();
+}
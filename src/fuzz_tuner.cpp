@@ -0,0 +1,213 @@
+#include "fuzz_tuner.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <libgen.h>
+#include <sstream>
+#include <sys/stat.h>
+
+static const unsigned int AXIS_CODES[fuzz_tuner::AXES] = { ABS_X, ABS_Y, ABS_RX, ABS_RY };
+// Share of resting deltas the fuzz has to swallow
+static const unsigned int NOISE_PERCENTILE = 90;
+
+//private
+int fuzz_tuner::axis_index(unsigned int code)
+{
+    switch (code) {
+        case ABS_X:
+            return 0;
+        case ABS_Y:
+            return 1;
+        case ABS_RX:
+            return 2;
+        case ABS_RY:
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+int fuzz_tuner::fuzz_limit(int base_fuzz)
+{
+    int limit = base_fuzz * MAX_FUZZ_FACTOR;
+    int min_limit = MIN_FUZZ_LIMIT;
+    int max_limit = MAX_FUZZ;
+
+    if (limit < min_limit)
+        limit = min_limit;
+    return limit > max_limit ? max_limit : limit;
+}
+
+bool fuzz_tuner::apply(struct axis& ax, int fuzz)
+{
+    const struct input_absinfo *current = libevdev_get_abs_info(evdev, ax.code);
+    if (!current || fuzz == current->fuzz)
+        return false;
+
+    struct input_absinfo absinfo = *current;
+    absinfo.fuzz = fuzz;
+    int ret = libevdev_kernel_set_abs_info(evdev, ax.code, &absinfo);
+    if (ret) {
+        std::cerr << "Failed to set fuzz of " << libevdev_event_code_get_name(EV_ABS, ax.code) << "; "
+                  << strerror(-ret) << std::endl;
+        return false;
+    }
+    ax.fuzz.store(fuzz, std::memory_order_relaxed);
+    return true;
+}
+
+// The kernel drops changes smaller than half the fuzz, so twice the typical resting delta hides it.
+// Fuzz is never lowered below what is applied: once applied, the jitter it hides can no longer be
+// measured. The limit keeps it from running away; --reset-fuzz starts over.
+void fuzz_tuner::tune(struct axis& ax)
+{
+    unsigned int wanted = ax.samples * NOISE_PERCENTILE / 100;
+    unsigned int seen = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < BUCKETS - 1; bucket++) {
+        seen += ax.histogram[bucket];
+        if (seen >= wanted)
+            break;
+    }
+    int fuzz = 2 * (bucket + 1) * BUCKET_WIDTH;
+    if (fuzz > ax.limit)
+        fuzz = ax.limit;
+
+    if (fuzz > ax.fuzz.load(std::memory_order_relaxed) && apply(ax, fuzz)) {
+        std::cout << "Raised fuzz of " << libevdev_event_code_get_name(EV_ABS, ax.code) << " on "
+                  << libevdev_get_uniq(evdev) << " to " << fuzz << std::endl;
+        dirty.store(true, std::memory_order_relaxed);
+    }
+
+    ax.samples = 0;
+    memset(ax.histogram, 0, sizeof(ax.histogram));
+}
+
+// Lines are "<axis> <tuned fuzz> <driver fuzz>"; files from before the driver's fuzz was kept
+// have only the first two, and then the fuzz the device has now is taken as the driver's.
+void fuzz_tuner::load(bool reset)
+{
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string name;
+        int fuzz;
+        int base_fuzz;
+
+        if (!(iss >> name >> fuzz))
+            continue;
+        int code = libevdev_event_code_from_name(EV_ABS, name.c_str());
+        int index = code < 0 ? -1 : axis_index(code);
+        if (index < 0 || !axes[index].present || fuzz < 0 || fuzz > MAX_FUZZ)
+            continue;
+
+        struct axis& ax = axes[index];
+        // The kernel keeps fuzz set by an earlier run until the controller reconnects
+        if (iss >> base_fuzz && base_fuzz >= 0 && base_fuzz <= MAX_FUZZ) {
+            ax.base_fuzz = base_fuzz;
+            ax.limit = fuzz_limit(base_fuzz);
+        }
+        if (reset) {
+            apply(ax, ax.base_fuzz);
+            dirty.store(true, std::memory_order_relaxed);
+        } else {
+            apply(ax, fuzz < ax.limit ? fuzz : ax.limit);
+        }
+    }
+}
+
+//public
+fuzz_tuner::fuzz_tuner(struct libevdev *evdev, std::string const &path, bool reset) :
+    evdev(evdev),
+    path(path),
+    axes(),
+    dirty(false)
+{
+    for (int i = 0; i < AXES; i++) {
+        struct axis& ax = axes[i];
+
+        ax.code = AXIS_CODES[i];
+        ax.present = libevdev_has_event_code(evdev, EV_ABS, ax.code);
+        ax.base_fuzz = ax.present ? libevdev_get_abs_fuzz(evdev, ax.code) : 0;
+        ax.limit = fuzz_limit(ax.base_fuzz);
+        ax.anchor = 0;
+        ax.still = 0;
+        ax.last = 0;
+        ax.samples = 0;
+        ax.fuzz.store(ax.base_fuzz, std::memory_order_relaxed);
+    }
+    load(reset);
+}
+
+fuzz_tuner::~fuzz_tuner()
+{
+}
+
+void fuzz_tuner::add_event(struct input_event const &ev)
+{
+    int index = axis_index(ev.code);
+    if (index < 0)
+        return;
+
+    struct axis& ax = axes[index];
+    // Jitter hovers around one spot, while even slow aiming soon leaves it
+    if (abs(ev.value) >= REST_RANGE || abs(ev.value - ax.anchor) > STILL_BAND) {
+        ax.anchor = ev.value;
+        ax.still = 0;
+    } else if (ax.still < STILL_REPORTS) {
+        ax.still++;
+    } else {
+        int delta = abs(ev.value - ax.last);
+        if (delta < BUCKETS * BUCKET_WIDTH) {
+            ax.histogram[delta / BUCKET_WIDTH]++;
+            if (++ax.samples == SAMPLES)
+                tune(ax);
+        }
+    }
+    ax.last = ev.value;
+}
+
+void fuzz_tuner::save()
+{
+    if (!dirty.exchange(false, std::memory_order_relaxed))
+        return;
+
+    // The state directory itself may not exist yet either
+    std::string dir = path;
+    dir = dirname(&dir[0]);
+    std::string state_dir = dir;
+    state_dir = dirname(&state_dir[0]);
+    for (auto& d : { state_dir, dir }) {
+        if (mkdir(d.c_str(), 0755) && errno != EEXIST) {
+            std::cerr << "Failed to create " << d << ": " << strerror(errno) << std::endl;
+            dirty.store(true, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        for (auto& ax : axes) {
+            if (ax.present)
+                file << libevdev_event_code_get_name(EV_ABS, ax.code) << " "
+                     << ax.fuzz.load(std::memory_order_relaxed) << " " << ax.base_fuzz << "\n";
+        }
+        if (!file) {
+            std::cerr << "Failed to write " << tmp << std::endl;
+            dirty.store(true, std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str())) {
+        std::cerr << "Failed to save " << path << ": " << strerror(errno) << std::endl;
+        dirty.store(true, std::memory_order_relaxed);
+    }
+}
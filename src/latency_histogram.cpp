@@ -0,0 +1,39 @@
+#include "latency_histogram.h"
+
+//public
+latency_histogram::latency_histogram() :
+    count(0),
+    sum(0)
+{
+    for (auto& bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+uint64_t latency_histogram::bucket_lower_bound(unsigned int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    unsigned int shift = bucket / SUB_BUCKETS - 1;
+    return (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+// Returns the lower bound of the bucket holding the p-th percentile (0 < p <= 100)
+uint64_t latency_histogram::percentile(double p) const
+{
+    uint64_t total = get_count();
+    uint64_t target = total * p / 100.0;
+    uint64_t seen = 0;
+
+    if (!total)
+        return 0;
+    if (target == 0)
+        target = 1;
+
+    for (unsigned int i = 0; i < NUM_BUCKETS; i++) {
+        seen += get_bucket(i);
+        if (seen >= target)
+            return bucket_lower_bound(i);
+    }
+    return bucket_lower_bound(NUM_BUCKETS - 1);
+}
@@ -1,6 +1,18 @@
+#include <getopt.h>
 #include <iostream>
+#include <memory>
+#include <sched.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
 #include "ctlr_mgr.h"
 #include "epoll_mgr.h"
+#include "joycond_config.h"
+#include "joycond_shm.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "realtime.h"
+#include "worker_thread.h"
 #if defined(ANDROID) || defined(__ANDROID__)
 #include "ctlr_detector_android.h"
 #include "android_log.h"
@@ -8,16 +20,224 @@
 #include "ctlr_detector_udev.h"
 #endif
 
+static void usage(char const *prog)
+{
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --raw-read              read controller reports directly instead of through libevdev\n"
+              << "  --remap-dir=DIR         load remap profiles from DIR (default " JOYCOND_REMAP_DIR ")\n"
+              << "  --merge-window=USEC     merge left/right Joy-Con frames arriving within USEC\n"
+              << "  --export-state          publish controller state snapshots under " JOYCOND_SHM_DIR "\n"
+              << "  --metrics[=PATH]        serve Prometheus metrics on PATH (default " JOYCOND_METRICS_SOCKET ")\n"
+              << "  --metrics-mode=MODE     octal permissions of the metrics socket (default 0660)\n"
+              << "  --metrics-group=GROUP   group owning the metrics socket\n"
+              << "  --workers=N             relay virtual controllers on N threads instead of the main loop\n"
+              << "  --pin[=CPU,...]         pin relay threads to the given CPUs (default: one per CPU in order)\n"
+#ifdef HAVE_IO_URING
+              << "  --io-uring              relay through io_uring instead of epoll\n"
+#endif
+              << "  --realtime[=PRIO]       lock memory and relay at SCHED_FIFO priority PRIO (default " << JOYCOND_RT_PRIORITY << ")\n"
+              << "  --busy-poll=USEC        keep reading a controller for USEC after input before sleeping\n"
+              << "  --busy-poll-budget=PCT  cap busy polling at PCT percent of each relay thread (default 20)\n"
+              << "  --pm-qos[=USEC]         hold cpu wakeup latency at USEC while playing (default " << JOYCOND_PM_QOS_LATENCY << ")\n"
+              << "  --pm-qos-idle=SEC       drop the latency request after SEC without input (default 60)\n"
+              << "  --adaptive-fuzz         raise stick fuzz to hide measured jitter, kept per controller\n"
+              << "  --reset-fuzz            retune stick fuzz from the driver's instead of saved values\n"
+              << "  --state-dir=DIR         keep learnt controller state in DIR (default " JOYCOND_STATE_DIR ")\n"
+              << "  --max-rate=HZ           write stick-only frames at most HZ times a second\n"
+              << "  --rumble-rate=HZ        send each controller at most HZ rumble reports a second\n"
+              << "  -h, --help              show this help\n";
+}
+
+static unsigned int parse_uint(char const *prog, char const *name, char const *arg, unsigned long max)
+{
+    char *end;
+    unsigned long val = strtoul(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || val > max) {
+        std::cerr << "Invalid value for --" << name << ": " << arg << std::endl;
+        usage(prog);
+        exit(EXIT_FAILURE);
+    }
+    return val;
+}
+
+static void parse_args(int argc, char *argv[], joycond_config& config)
+{
+    enum { OPT_RAW_READ = 256, OPT_REMAP_DIR, OPT_MERGE_WINDOW, OPT_EXPORT_STATE, OPT_METRICS, OPT_WORKERS, OPT_PIN, OPT_IO_URING,
+           OPT_REALTIME, OPT_BUSY_POLL, OPT_BUSY_POLL_BUDGET,
+           OPT_PM_QOS, OPT_PM_QOS_IDLE, OPT_ADAPTIVE_FUZZ, OPT_RESET_FUZZ, OPT_STATE_DIR,
+           OPT_MAX_RATE, OPT_RUMBLE_RATE, OPT_METRICS_MODE, OPT_METRICS_GROUP };
+    static struct option const long_options[] = {
+        { "raw-read",       no_argument,       nullptr, OPT_RAW_READ },
+        { "remap-dir",      required_argument, nullptr, OPT_REMAP_DIR },
+        { "merge-window",   required_argument, nullptr, OPT_MERGE_WINDOW },
+        { "export-state",   no_argument,       nullptr, OPT_EXPORT_STATE },
+        { "metrics",        optional_argument, nullptr, OPT_METRICS },
+        { "metrics-mode",   required_argument, nullptr, OPT_METRICS_MODE },
+        { "metrics-group",  required_argument, nullptr, OPT_METRICS_GROUP },
+        { "workers",        required_argument, nullptr, OPT_WORKERS },
+        { "pin",            optional_argument, nullptr, OPT_PIN },
+#ifdef HAVE_IO_URING
+        { "io-uring",       no_argument,       nullptr, OPT_IO_URING },
+#endif
+        { "realtime",       optional_argument, nullptr, OPT_REALTIME },
+        { "busy-poll",      required_argument, nullptr, OPT_BUSY_POLL },
+        { "busy-poll-budget", required_argument, nullptr, OPT_BUSY_POLL_BUDGET },
+        { "pm-qos",         optional_argument, nullptr, OPT_PM_QOS },
+        { "pm-qos-idle",    required_argument, nullptr, OPT_PM_QOS_IDLE },
+        { "adaptive-fuzz",  no_argument,       nullptr, OPT_ADAPTIVE_FUZZ },
+        { "reset-fuzz",     no_argument,       nullptr, OPT_RESET_FUZZ },
+        { "state-dir",      required_argument, nullptr, OPT_STATE_DIR },
+        { "max-rate",       required_argument, nullptr, OPT_MAX_RATE },
+        { "rumble-rate",    required_argument, nullptr, OPT_RUMBLE_RATE },
+        { "help",           no_argument,       nullptr, 'h' },
+        { nullptr,          0,                 nullptr, 0 },
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case OPT_RAW_READ:
+                config.raw_read = true;
+                break;
+            case OPT_REMAP_DIR:
+                config.remap_dir = optarg;
+                break;
+            case OPT_MERGE_WINDOW:
+                config.merge_window_us = parse_uint(argv[0], "merge-window", optarg, 999999);
+                break;
+            case OPT_EXPORT_STATE:
+                config.export_state = true;
+                break;
+            case OPT_METRICS:
+                config.metrics_socket = optarg ? optarg : JOYCOND_METRICS_SOCKET;
+                break;
+            case OPT_METRICS_MODE:
+                {
+                    char *end;
+                    unsigned long mode = strtoul(optarg, &end, 8);
+
+                    if (*optarg == '\0' || *end != '\0' || mode > 0777) {
+                        std::cerr << "Invalid value for --metrics-mode: " << optarg << std::endl;
+                        usage(argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    config.metrics_mode = mode;
+                    break;
+                }
+            case OPT_METRICS_GROUP:
+                config.metrics_group = optarg;
+                break;
+            case OPT_WORKERS:
+                config.workers = parse_uint(argv[0], "workers", optarg, 64);
+                break;
+            case OPT_PIN:
+                config.pin_cpus.clear();
+                if (optarg) {
+                    std::string list = optarg;
+                    size_t start = 0;
+                    while (start <= list.size()) {
+                        size_t end = list.find(',', start);
+                        if (end == std::string::npos)
+                            end = list.size();
+                        std::string cpu = list.substr(start, end - start);
+                        config.pin_cpus.push_back(parse_uint(argv[0], "pin", cpu.c_str(), CPU_SETSIZE - 1));
+                        start = end + 1;
+                    }
+                } else {
+                    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    for (long i = 0; i < cpus; i++)
+                        config.pin_cpus.push_back(i);
+                }
+                break;
+            case OPT_IO_URING:
+                config.io_uring = true;
+                break;
+            case OPT_REALTIME:
+                config.realtime_priority = optarg ? parse_uint(argv[0], "realtime", optarg, 99) : JOYCOND_RT_PRIORITY;
+                if (!config.realtime_priority) {
+                    std::cerr << "Invalid value for --realtime: " << optarg << std::endl;
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_BUSY_POLL:
+                config.busy_poll_us = parse_uint(argv[0], "busy-poll", optarg, 999999);
+                break;
+            case OPT_BUSY_POLL_BUDGET:
+                config.busy_poll_budget = parse_uint(argv[0], "busy-poll-budget", optarg, 100);
+                break;
+            case OPT_PM_QOS:
+                config.pm_qos_latency_us = optarg ? parse_uint(argv[0], "pm-qos", optarg, 999999)
+                                                  : JOYCOND_PM_QOS_LATENCY;
+                break;
+            case OPT_PM_QOS_IDLE:
+                config.pm_qos_idle_s = parse_uint(argv[0], "pm-qos-idle", optarg, 86400);
+                break;
+            case OPT_ADAPTIVE_FUZZ:
+                config.adaptive_fuzz = true;
+                break;
+            case OPT_RESET_FUZZ:
+                config.reset_fuzz = true;
+                break;
+            case OPT_STATE_DIR:
+                config.state_dir = optarg;
+                break;
+            case OPT_MAX_RATE:
+                config.max_rate_hz = parse_uint(argv[0], "max-rate", optarg, 100000);
+                break;
+            case OPT_RUMBLE_RATE:
+                config.rumble_rate_hz = parse_uint(argv[0], "rumble-rate", optarg, 1000);
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    epoll_mgr epoll_manager;
-    ctlr_mgr ctlr_manager(epoll_manager);
+    joycond_config config;
+
+    parse_args(argc, argv, config);
+    if (config.realtime_priority)
+        realtime_lock_memory();
+
+    metrics_registry metrics;
+    // The relay loop; the control thread keeps epoll since the detectors don't drain their sockets
+    epoll_mgr epoll_manager(config.io_uring ? epoll_mgr::Backend::Io_Uring : epoll_mgr::Backend::Epoll);
+    metrics.add_source(&epoll_manager, [&](metrics_writer& writer){
+        epoll_manager.write_metrics(writer, "thread=\"main\"");
+    });
 #if defined(ANDROID) || defined(__ANDROID__)
     std::cout.rdbuf(new androidbuf); // Redirect cout to logcat
-    ctlr_detector_android android_detector(ctlr_manager, epoll_manager);
+#endif
+
+    // Hotplug handling and everything else that may block stays off the thread relaying input
+    worker_thread control("control", -1, metrics);
+    // Worker threads set their own policy, so the order doesn't matter for them
+    if (config.realtime_priority)
+        epoll_manager.set_realtime(config.realtime_priority, "main");
+    ctlr_mgr ctlr_manager(epoll_manager, control, config, metrics);
+    std::unique_ptr<metrics_server> metrics_srv;
+#if defined(ANDROID) || defined(__ANDROID__)
+    std::unique_ptr<ctlr_detector_android> android_detector;
+#else
+    std::unique_ptr<ctlr_detector_udev> udev_detector;
+#endif
+    control.run_sync([&](){
+        if (!config.metrics_socket.empty())
+            metrics_srv.reset(new metrics_server(metrics, control.get_epoll_mgr(), config));
+#if defined(ANDROID) || defined(__ANDROID__)
+        android_detector.reset(new ctlr_detector_android(ctlr_manager, control.get_epoll_mgr()));
 #else
-    ctlr_detector_udev udev_detector(ctlr_manager, epoll_manager);
+        udev_detector.reset(new ctlr_detector_udev(ctlr_manager, control.get_epoll_mgr()));
 #endif
+    });
 
     while (true) {
         epoll_manager.loop();
@@ -0,0 +1,104 @@
+#include "metrics.h"
+
+#include <sstream>
+
+//private
+struct metrics_writer::family& metrics_writer::get_family(std::string const &name, std::string const &help,
+                                                          std::string const &type)
+{
+    auto it = families.find(name);
+    if (it != families.end())
+        return it->second;
+
+    order.push_back(name);
+    struct family& fam = families[name];
+    fam.help = help;
+    fam.type = type;
+    return fam;
+}
+
+//public
+std::string metrics_writer::label(std::string const &name, std::string const &value)
+{
+    std::string out = name + "=\"";
+
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            out += '\\';
+        if (c == '\n')
+            out += "\\n";
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+void metrics_writer::counter(std::string const &name, std::string const &help, std::string const &labels,
+                             uint64_t value)
+{
+    get_family(name, help, "counter").samples.push_back(name + "{" + labels + "} " + std::to_string(value));
+}
+
+void metrics_writer::counter(std::string const &name, std::string const &help, std::string const &labels,
+                             double value)
+{
+    std::ostringstream sample;
+
+    sample << name << "{" << labels << "} " << value;
+    get_family(name, help, "counter").samples.push_back(sample.str());
+}
+
+void metrics_writer::summary(std::string const &name, std::string const &help, std::string const &labels,
+                             const latency_histogram &hist)
+{
+    struct family& fam = get_family(name, help, "summary");
+    std::string sep = labels.empty() ? "" : ",";
+
+    for (double q : { 50.0, 99.0, 99.9 }) {
+        std::ostringstream sample;
+        sample << name << "{" << labels << sep << "quantile=\"" << q / 100 << "\"} " << hist.percentile(q) / 1e9;
+        fam.samples.push_back(sample.str());
+    }
+
+    std::ostringstream sum;
+    sum << name << "_sum{" << labels << "} " << hist.get_sum() / 1e9;
+    fam.samples.push_back(sum.str());
+    fam.samples.push_back(name + "_count{" + labels + "} " + std::to_string(hist.get_count()));
+}
+
+std::string metrics_writer::str() const
+{
+    std::string out;
+
+    for (auto& name : order) {
+        const struct family& fam = families.at(name);
+
+        out += "# HELP " + name + " " + fam.help + "\n";
+        out += "# TYPE " + name + " " + fam.type + "\n";
+        for (auto& sample : fam.samples)
+            out += sample + "\n";
+    }
+    return out;
+}
+
+void metrics_registry::add_source(const void *owner, std::function<void(metrics_writer&)> source)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    sources[owner] = source;
+}
+
+void metrics_registry::remove_source(const void *owner)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    sources.erase(owner);
+}
+
+std::string metrics_registry::collect()
+{
+    metrics_writer writer;
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (auto& kv : sources)
+        kv.second(writer);
+    return writer.str();
+}
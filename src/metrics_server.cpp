@@ -0,0 +1,96 @@
+#include "metrics_server.h"
+
+#include <cerrno>
+#include <cstring>
+#include <grp.h>
+#include <iostream>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//private
+void metrics_server::epoll_event_callback(int event_fd)
+{
+    int client;
+
+    while ((client = accept4(sock_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        std::string text = metrics.collect();
+        size_t off = 0;
+
+        while (off < text.size()) {
+            ssize_t ret = send(client, text.data() + off, text.size() - off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (ret <= 0)
+                break;
+            off += ret;
+        }
+        close(client);
+    }
+}
+
+//public
+metrics_server::metrics_server(metrics_registry& metrics, epoll_mgr& epoll_manager, const joycond_config& config) :
+    metrics(metrics),
+    epoll_manager(epoll_manager),
+    subscriber(nullptr),
+    path(config.metrics_socket),
+    sock_fd(-1)
+{
+    struct sockaddr_un addr = { 0 };
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Metrics socket path is too long: " << path << std::endl;
+        return;
+    }
+
+    std::string dir = path;
+    dir = dirname(&dir[0]);
+    if (mkdir(dir.c_str(), 0755) && errno != EEXIST)
+        std::cerr << "Failed to create " << dir << ": " << strerror(errno) << std::endl;
+
+    sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+        std::cerr << "Failed to create metrics socket: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    // bind() creates the node with the socket inode's mode, so it is never more open than asked for
+    fchmod(sock_fd, config.metrics_mode);
+    if (bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock_fd, 8)) {
+        std::cerr << "Failed to listen on " << path << ": " << strerror(errno) << std::endl;
+        close(sock_fd);
+        sock_fd = -1;
+        return;
+    }
+    // The umask applied at bind() may have taken bits away
+    if (chmod(path.c_str(), config.metrics_mode))
+        std::cerr << "Failed to set the mode of " << path << ": " << strerror(errno) << std::endl;
+    if (!config.metrics_group.empty()) {
+        struct group *grp = getgrnam(config.metrics_group.c_str());
+
+        if (!grp)
+            std::cerr << "Unknown group for the metrics socket: " << config.metrics_group << std::endl;
+        else if (chown(path.c_str(), -1, grp->gr_gid))
+            std::cerr << "Failed to change the group of " << path << ": " << strerror(errno) << std::endl;
+    }
+
+    subscriber = std::make_shared<epoll_subscriber>(std::vector({sock_fd}),
+                                                    [=](int event_fd){epoll_event_callback(event_fd);},
+                                                    "metrics");
+    epoll_manager.add_subscriber(subscriber);
+    std::cout << "Serving metrics on " << path << std::endl;
+}
+
+metrics_server::~metrics_server()
+{
+    if (sock_fd < 0)
+        return;
+
+    epoll_manager.remove_subscriber(subscriber);
+    close(sock_fd);
+    unlink(path.c_str());
+}
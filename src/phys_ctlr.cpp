@@ -1,10 +1,13 @@
 #include "phys_ctlr.h"
 
 #include <fcntl.h>
+#include <fstream>
 #include <iostream>
 #include <glob.h>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -26,118 +29,147 @@ std::optional<std::string> phys_ctlr::get_first_glob_path(std::string const &pat
     return std::nullopt;
 }
 
-std::optional<std::string> phys_ctlr::get_led_path(std::string const &name)
+// The HID device, which is the parent of the LED class devices
+std::string phys_ctlr::get_hid_dir() const
 {
     // Android links sysfs differently
 #if defined(ANDROID) || defined(__ANDROID__)
-    return get_first_glob_path(std::string("/sys/") + devpath + "/device/leds/*" + name);
+    return std::string("/sys/") + devpath + "/device";
 #else
-    return get_first_glob_path(std::string("/sys/") + devpath + "/device/device/leds/*" + name);
+    return std::string("/sys/") + devpath + "/device/device";
 #endif
 }
 
-void phys_ctlr::init_leds()
+std::optional<std::string> phys_ctlr::get_led_path(std::string const &name)
 {
-    std::optional<std::string> tmp;
-    for (unsigned int i = 0; i < 100; i++) {
-        tmp = get_led_path("player*1");
-        if (tmp.has_value()) {
-            player_leds[0].open(tmp.value() + "/brightness");
-            if (!player_leds[0].is_open()) {
-                std::cerr << "Failed to open player1 led brightness\n";
-                usleep(10);
-                continue;
-            }
-            player_led_triggers[0].open(tmp.value() + "/trigger");
-            if (!player_led_triggers[0].is_open()) {
-                std::cerr << "Failed to open player1 trigger\n";
-                usleep(10);
-                continue;
-            }
-            break;
-        }
-        usleep(10);
+    return get_first_glob_path(get_hid_dir() + "/leds/*" + name);
+}
+
+// Opens player LED index at path and replays whatever was requested before it appeared
+bool phys_ctlr::attach_player_led(unsigned int index, std::string const &path)
+{
+    if (player_leds[index].has_trigger())
+        return true;
+    if (!player_leds[index].open(path, true)) {
+        std::cerr << "Failed to open player" << index + 1 << " led; " << strerror(errno) << std::endl;
+        return false;
     }
 
-    for (unsigned int i = 0; i < 100; i++) {
-        tmp = get_led_path("player*2");
-        if (tmp.has_value()) {
-            player_leds[1].open(tmp.value() + "/brightness");
-            if (!player_leds[1].is_open()) {
-                std::cerr << "Failed to open player2 led brightness\n";
-                usleep(10);
-                continue;
-            }
-            player_led_triggers[1].open(tmp.value() + "/trigger");
-            if (!player_led_triggers[1].is_open()) {
-                std::cerr << "Failed to open player2 trigger\n";
-                usleep(10);
-                continue;
-            }
-            break;
-        }
-        usleep(10);
+    if (pending_player_leds[index].has_value())
+        set_player_led(index, pending_player_leds[index].value());
+    if (pending_blink[index])
+        start_blink(index);
+    pending_player_leds[index].reset();
+    pending_blink[index] = false;
+    return true;
+}
+
+bool phys_ctlr::attach_home_led(std::string const &path)
+{
+    if (home_led.is_open())
+        return true;
+    if (!home_led.open(path, false)) {
+        std::cerr << "Failed to open home led brightness; " << strerror(errno) << std::endl;
+        return false;
     }
 
-    for (unsigned int i = 0; i < 100; i++) {
-        tmp = get_led_path("player*3");
-        if (tmp.has_value()) {
-            player_leds[2].open(tmp.value() + "/brightness");
-            if (!player_leds[2].is_open()) {
-                std::cerr << "Failed to open player3 led brightness\n";
-                usleep(10);
-                continue;
-            }
-            player_led_triggers[2].open(tmp.value() + "/trigger");
-            if (!player_led_triggers[2].is_open()) {
-                std::cerr << "Failed to open player3 trigger\n";
-                usleep(10);
-                continue;
-            }
-            break;
-        }
-        usleep(10);
+    if (pending_home_led.has_value())
+        set_home_led(pending_home_led.value());
+    pending_home_led.reset();
+    return true;
+}
+
+// Whether every LED this controller has is open
+bool phys_ctlr::leds_attached() const
+{
+    for (unsigned int i = 0; i < 4; i++) {
+        if (!player_leds[i].has_trigger())
+            return false;
     }
+    return model == Model::Left_Joycon || home_led.is_open();
+}
 
-    for (unsigned int i = 0; i < 100; i++) {
-        tmp = get_led_path("player*4");
-        if (tmp.has_value()) {
-            player_leds[3].open(tmp.value() + "/brightness");
-            if (!player_leds[3].is_open()) {
-                std::cerr << "Failed to open player4 led brightness\n";
-                usleep(10);
-                continue;
-            }
-            player_led_triggers[3].open(tmp.value() + "/trigger");
-            if (!player_led_triggers[3].is_open()) {
-                std::cerr << "Failed to open player4 trigger\n";
-                usleep(10);
-                continue;
-            }
-            break;
+// Looks for whichever LEDs are still missing. Returns true once every LED this controller has is open.
+bool phys_ctlr::open_leds()
+{
+    std::optional<std::string> tmp;
+
+    for (unsigned int i = 0; i < 4; i++) {
+        if (player_leds[i].has_trigger())
+            continue;
+
+        tmp = get_led_path("player*" + std::to_string(i + 1));
+        if (tmp.has_value())
+            attach_player_led(i, tmp.value());
+    }
+
+    if (model != Model::Left_Joycon && !home_led.is_open()) {
+        tmp = get_led_path("player*5");
+        if (!tmp.has_value()) {
+            tmp = get_led_path("home");
         }
-        usleep(10);
+        if (tmp.has_value())
+            attach_home_led(tmp.value());
     }
 
-    if (model != Model::Left_Joycon) {
-        for (unsigned int i = 0; i < 100; i++) {
-            tmp = get_led_path("player*5");
-            if (!tmp.has_value()) {
-                tmp = get_led_path("home");
-            }
-            if (tmp.has_value()) {
-                home_led.open(tmp.value() + "/brightness");
-                if (!home_led.is_open()) {
-                    std::cerr << "Failed to open home led brightness\n";
-                    usleep(10);
-                    continue;
-                }
-                break;
-            }
-            usleep(10);
+    return leds_attached();
+}
+
+void phys_ctlr::init_leds()
+{
+    char *hid_dir = realpath(get_hid_dir().c_str(), nullptr);
+
+    // attach_led() compares against the canonical path udev reports
+    if (hid_dir) {
+        led_dir = std::string(hid_dir) + "/leds/";
+        free(hid_dir);
+    }
+    if (!open_leds())
+        retry_leds();
+}
+
+// hid-nintendo registers the LED class devices after the input device. They normally turn up through
+// attach_led(); look for them now and then in case no udev event does, less often as time goes on.
+void phys_ctlr::retry_leds()
+{
+    unsigned int shift = led_retries < LED_RETRY_BACKOFF ? led_retries : LED_RETRY_BACKOFF;
+    uint64_t delay = LED_RETRY_NS << shift;
+
+    led_timer = epoll_manager.add_timer(delay, [this](){
+        led_timer = 0;
+        if (open_leds())
+            return;
+        if (++led_retries < LED_RETRIES) {
+            retry_leds();
+            return;
+        }
+        std::cerr << "Gave up waiting for the LEDs of " << devpath << std::endl;
+        for (unsigned int i = 0; i < 4; i++) {
+            pending_player_leds[i].reset();
+            pending_blink[i] = false;
         }
+        pending_home_led.reset();
+    });
+}
+
+bool phys_ctlr::start_blink(int index)
+{
+    enum sysfs_led::Result result = player_leds[index].start_blink();
+
+    count_led_write(result);
+    if (result == sysfs_led::Result::Failed) {
+        std::cerr << "Failed to select LED timer trigger. Is ledtrig-timer module probed?\n";
+        return false;
     }
+    return true;
+}
 
+void phys_ctlr::count_led_write(enum sysfs_led::Result result)
+{
+    if (result == sysfs_led::Result::Unchanged)
+        led_writes_skipped.add();
+    else
+        led_writes.add();
 }
 
 void phys_ctlr::handle_event(struct input_event const &ev)
@@ -216,12 +248,39 @@ void phys_ctlr::handle_event(struct input_event const &ev)
     }
 }
 
+static bool set_kernel_mask(int fd, unsigned int type, const unsigned char *codes, size_t size)
+{
+    struct input_mask mask = { type, (unsigned int)size, (uint64_t)(uintptr_t)codes };
+
+    return !ioctl(fd, EVIOCSMASK, &mask);
+}
+
 //public
-phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname) :
+phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname, epoll_mgr& epoll_manager,
+                     joycond_config const &config, metrics_registry& metrics) :
     devpath(devpath),
     devname(devname),
+    epoll_manager(epoll_manager),
     evdev(nullptr),
-    is_serial(false)
+    is_serial(false),
+    led_dir(),
+    pending_player_leds(),
+    pending_blink(),
+    pending_home_led(),
+    led_timer(0),
+    led_retries(0),
+    raw_read(config.raw_read),
+    resyncing(false),
+    event_mask_supported(true),
+    raw_events(),
+    raw_head(0),
+    raw_count(0),
+    stats(),
+    fuzz(nullptr),
+    fuzz_timer(0),
+    led_writes(),
+    led_writes_skipped(),
+    metrics(metrics)
 {
 
     zero_triggers();
@@ -236,6 +295,10 @@ phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname) :
         exit(1);
     }
 
+    // Event timestamps are compared against CLOCK_MONOTONIC for the latency histograms
+    if (libevdev_set_clock_id(evdev, CLOCK_MONOTONIC))
+        std::cerr << "Failed to set evdev clock to CLOCK_MONOTONIC\n";
+
     int product_id = libevdev_get_id_product(evdev);
     // Extra checks are required for charging grip
     if (product_id == 0x200e) {
@@ -301,10 +364,24 @@ phys_ctlr::phys_ctlr(std::string const &devpath, std::string const &devname) :
 #endif
     std::getline(funiq, mac_addr);
     std::cout << "MAC: " << mac_addr << std::endl;
+
+    if (config.adaptive_fuzz && !mac_addr.empty()) {
+        fuzz.reset(new fuzz_tuner(evdev, config.state_dir + "/fuzz/" + mac_addr, config.reset_fuzz));
+        fuzz_timer = epoll_manager.add_timer(FUZZ_SAVE_NS, [=](){save_fuzz();});
+    }
+
+    metrics.add_source(this, [this](metrics_writer& writer){write_metrics(writer);});
 }
 
 phys_ctlr::~phys_ctlr()
 {
+    metrics.remove_source(this);
+    if (led_timer)
+        epoll_manager.cancel_timer(led_timer);
+    if (fuzz_timer)
+        epoll_manager.cancel_timer(fuzz_timer);
+    if (fuzz)
+        fuzz->save();
     if (evdev) {
         int fd = libevdev_get_fd(evdev);
         libevdev_free(evdev);
@@ -312,13 +389,49 @@ phys_ctlr::~phys_ctlr()
     }
 }
 
+bool phys_ctlr::attach_led(std::string const &syspath)
+{
+    if (led_dir.empty() || syspath.compare(0, led_dir.size(), led_dir))
+        return false;
+
+    std::string name = syspath.substr(led_dir.size());
+    if (name.find('/') != std::string::npos)
+        return false;
+
+    // Same names the globs in open_leds() look for
+    size_t player = name.rfind("player");
+    char last = name.empty() ? '\0' : name.back();
+    if (name.size() >= 4 && !name.compare(name.size() - 4, 4, "home"))
+        attach_home_led(syspath);
+    else if (player != std::string::npos && last >= '1' && last <= '4')
+        attach_player_led(last - '1', syspath);
+    else if (player != std::string::npos && last == '5' && model != Model::Left_Joycon)
+        attach_home_led(syspath);
+
+    if (led_timer && leds_attached()) {
+        epoll_manager.cancel_timer(led_timer);
+        led_timer = 0;
+    }
+    return true;
+}
+
 bool phys_ctlr::set_player_led(int index, bool on)
 {
-    if (index > 3 || !player_leds[index].is_open() || is_serial)
+    if (index > 3 || is_serial)
         return false;
 
-    player_leds[index] << (on ? '1' : '0');
-    player_leds[index].flush();
+    if (!player_leds[index].is_open()) {
+        if (!led_timer)
+            return false;
+        pending_player_leds[index] = on;
+        pending_blink[index] = false;
+        return true;
+    }
+
+    enum sysfs_led::Result result = player_leds[index].set_brightness(on);
+    count_led_write(result);
+    if (result == sysfs_led::Result::Failed)
+        std::cerr << "Failed to set player" << index + 1 << " led; " << strerror(errno) << std::endl;
     return true;
 }
 
@@ -338,20 +451,28 @@ bool phys_ctlr::set_player_leds_to_player(int player)
         return false;
     }
 
-    set_all_player_leds(false);
-    for (int i = 0; i < player; i++) {
-        set_player_led(i, true);
-    }
+    // Straight to the final state; only LEDs that differ from it get written
+    for (int i = 0; i < 4; i++)
+        set_player_led(i, i < player);
     return true;
 }
 
 bool phys_ctlr::set_home_led(unsigned short brightness)
 {
-    if (brightness > 15 || !home_led.is_open())
+    if (brightness > 15)
         return false;
 
-    home_led << brightness;
-    home_led.flush();
+    if (!home_led.is_open()) {
+        if (!led_timer)
+            return false;
+        pending_home_led = brightness;
+        return true;
+    }
+
+    enum sysfs_led::Result result = home_led.set_brightness(brightness);
+    count_led_write(result);
+    if (result == sysfs_led::Result::Failed)
+        std::cerr << "Failed to set home led; " << strerror(errno) << std::endl;
     return true;
 }
 
@@ -361,13 +482,12 @@ bool phys_ctlr::blink_player_leds()
     set_all_player_leds(false);
 
     for (int i = 0; i < 4; i++) {
-        try {
-            player_led_triggers[i] << "timer";
-            player_led_triggers[i].flush();
-        } catch (std::exception& e) {
-            std::cerr << "Failed to select LED timer trigger. Is ledtrig-timer module probed?\n";
-            return false;
+        if (!player_leds[i].has_trigger()) {
+            pending_blink[i] = led_timer != 0;
+            continue;
         }
+        if (!start_blink(i))
+            return false;
     }
     return true;
 }
@@ -377,23 +497,126 @@ int phys_ctlr::get_fd()
     return libevdev_get_fd(evdev);
 }
 
-void phys_ctlr::handle_events()
+bool phys_ctlr::handle_events()
 {
     struct input_event ev;
+    bool syncing = false;
 
-    int ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-    while (ret == LIBEVDEV_READ_STATUS_SYNC || ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-        if (ret == LIBEVDEV_READ_STATUS_SYNC) {
+    for (unsigned int count = 0; count < EVENT_BUDGET; count++) {
+        int ret = next_event(ev);
+        if (ret != LIBEVDEV_READ_STATUS_SYNC && ret != LIBEVDEV_READ_STATUS_SUCCESS)
+            return false;
+        if (ret == LIBEVDEV_READ_STATUS_SYNC && !syncing)
             std::cout << "handle sync\n";
-            while (ret == LIBEVDEV_READ_STATUS_SYNC) {
-                handle_event(ev);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-            }
+        syncing = ret == LIBEVDEV_READ_STATUS_SYNC;
+        handle_event(ev);
+    }
+    return true;
+}
+
+// Filters in the kernel, so that a controller waiting to be paired only wakes us for the buttons
+// get_pairing_state() looks at, and a passthrough controller doesn't wake us at all
+void phys_ctlr::set_event_mask(enum EventMask mask)
+{
+    unsigned char types[(EV_MAX + 8) / 8] = { 0 };
+    unsigned char keys[(KEY_MAX + 8) / 8] = { 0 };
+    static const unsigned int pairing_keys[] = { BTN_TL, BTN_TL2, BTN_TR, BTN_TR2, BTN_START, BTN_SELECT };
+    int fd = get_fd();
+
+    if (!event_mask_supported)
+        return;
+
+    switch (mask) {
+        case EventMask::Pairing:
+            types[EV_KEY / 8] |= 1 << (EV_KEY % 8);
+            for (auto key : pairing_keys)
+                keys[key / 8] |= 1 << (key % 8);
+            break;
+        case EventMask::Relay:
+            memset(types, 0xff, sizeof(types));
+            memset(keys, 0xff, sizeof(keys));
+            break;
+        case EventMask::None:
+            break;
+    }
+
+    // Whatever gets through in between is a superset of the old mask or of the new one. EV_SYN is
+    // never filtered, but the kernel drops a SYN_REPORT once everything before it was.
+    bool ok;
+    if (mask == EventMask::None)
+        ok = set_kernel_mask(fd, 0, types, sizeof(types));
+    else if (mask == EventMask::Relay)
+        ok = set_kernel_mask(fd, EV_KEY, keys, sizeof(keys)) && set_kernel_mask(fd, 0, types, sizeof(types));
+    else
+        ok = set_kernel_mask(fd, 0, types, sizeof(types)) && set_kernel_mask(fd, EV_KEY, keys, sizeof(keys));
+    if (!ok) {
+        std::cerr << "EVIOCSMASK failed for " << devpath << "; " << strerror(errno)
+                  << "; reading unfiltered events\n";
+        event_mask_supported = false;
+    }
+}
+
+// Runs on the control thread, while the tuner itself is fed from the relay
+void phys_ctlr::save_fuzz()
+{
+    fuzz->save();
+    fuzz_timer = epoll_manager.add_timer(FUZZ_SAVE_NS, [=](){save_fuzz();});
+}
+
+// Same contract as libevdev_next_event(): SUCCESS for a normal event, SYNC while resyncing
+// after SYN_DROPPED, and a negative errno once nothing is left to read.
+int phys_ctlr::next_event(struct input_event &ev)
+{
+    int ret;
+
+    if (resyncing) {
+        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+        if (ret != LIBEVDEV_READ_STATUS_SYNC)
+            resyncing = false;
+        return ret;
+    }
+
+    if (!raw_read) {
+        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        if (ret == LIBEVDEV_READ_STATUS_SYNC) {
+            resyncing = true;
+            stats.resyncs.add();
         } else if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-            handle_event(ev);
+            stats.events.add();
+            if (fuzz && ev.type == EV_ABS)
+                fuzz->add_event(ev);
         }
-        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        return ret;
     }
+
+    if (raw_head == raw_count) {
+        ssize_t len = read(get_fd(), raw_events, sizeof(raw_events));
+        if (len < 0)
+            return -errno;
+        if ((size_t)len < sizeof(struct input_event))
+            return -EAGAIN;
+        stats.reads.add();
+        raw_head = 0;
+        raw_count = len / sizeof(struct input_event);
+    }
+
+    ev = raw_events[raw_head++];
+    if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+        // Whatever is left in the buffer is incomplete; let libevdev rebuild the state from the kernel
+        raw_head = raw_count;
+        resyncing = true;
+        stats.resyncs.add();
+        return libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_FORCE_SYNC, &ev);
+    }
+
+    // libevdev never sees these, but a resync reports how the kernel's state differs from the one
+    // libevdev keeps, so that has to follow what was relayed
+    if (ev.type == EV_KEY || ev.type == EV_ABS)
+        libevdev_set_event_value(evdev, ev.type, ev.code, ev.value);
+    stats.events.add();
+    if (fuzz && ev.type == EV_ABS)
+        fuzz->add_event(ev);
+    return LIBEVDEV_READ_STATUS_SUCCESS;
 }
 
 enum phys_ctlr::PairingState phys_ctlr::get_pairing_state() const
@@ -449,3 +672,20 @@ void phys_ctlr::zero_triggers()
 {
     l = zl = r = zr = sl = sr = plus = minus = 0;
 }
+
+void phys_ctlr::write_metrics(metrics_writer& writer) const
+{
+    std::string labels = metrics_writer::label("device", devname.substr(devname.rfind('/') + 1)) + "," +
+                         metrics_writer::label("mac", mac_addr);
+
+    writer.counter("joycond_phys_reads_total", "read() calls on the evdev in raw-read mode", labels,
+                   stats.reads.get());
+    writer.counter("joycond_phys_events_total", "Events read from the physical controller", labels,
+                   stats.events.get());
+    writer.counter("joycond_phys_syn_dropped_total", "SYN_DROPPED resyncs of the physical controller", labels,
+                   stats.resyncs.get());
+    writer.counter("joycond_phys_led_writes_total", "Writes to the controller's LED class devices", labels,
+                   led_writes.get());
+    writer.counter("joycond_phys_led_writes_skipped_total", "LED writes dropped because the LED already had that state",
+                   labels, led_writes_skipped.get());
+}
@@ -0,0 +1,174 @@
+#include "pm_qos.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// touch() only publishes input times this far apart, so relay threads rarely share a dirty line
+static const uint64_t TOUCH_GRANULARITY_NS = 100000000ULL;
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//private
+void pm_qos::acquire()
+{
+    int32_t value = latency_us;
+
+    if (qos_fd >= 0)
+        return;
+
+    qos_fd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+    if (qos_fd < 0) {
+        std::cerr << "Failed to open /dev/cpu_dma_latency; " << strerror(errno) << std::endl;
+        return;
+    }
+    if (write(qos_fd, &value, sizeof(value)) != sizeof(value)) {
+        std::cerr << "Failed to request cpu latency; " << strerror(errno) << std::endl;
+        close(qos_fd);
+        qos_fd = -1;
+        return;
+    }
+    std::cout << "Holding cpu latency at " << latency_us << "us\n";
+    stats.acquired.add();
+    held.store(true, std::memory_order_relaxed);
+    arm_idle_timer(idle_ns);
+}
+
+void pm_qos::release()
+{
+    if (idle_timer) {
+        epoll_manager.cancel_timer(idle_timer);
+        idle_timer = 0;
+    }
+    if (qos_fd < 0)
+        return;
+
+    close(qos_fd);
+    qos_fd = -1;
+    held.store(false, std::memory_order_relaxed);
+    stats.released.add();
+    std::cout << "Released cpu latency request\n";
+}
+
+void pm_qos::arm_idle_timer(uint64_t delay_ns)
+{
+    if (idle_timer)
+        epoll_manager.cancel_timer(idle_timer);
+    idle_timer = epoll_manager.add_timer(delay_ns, [=](){handle_idle_timer();});
+}
+
+void pm_qos::handle_idle_timer()
+{
+    // Loaded before reading the clock, so that it can't be newer than now
+    uint64_t last = last_input_ns.load(std::memory_order_relaxed);
+    uint64_t now = now_ns();
+
+    idle_timer = 0;
+    // Input times are published coarsely, so allow for one granule of staleness
+    if (now - last < idle_ns + TOUCH_GRANULARITY_NS)
+        arm_idle_timer(last + idle_ns + TOUCH_GRANULARITY_NS - now);
+    else
+        release();
+}
+
+void pm_qos::handle_wake()
+{
+    uint64_t count;
+
+    if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        std::cerr << "Failed to read pm_qos eventfd; " << strerror(errno) << std::endl;
+    wake_pending.store(false, std::memory_order_relaxed);
+    if (active)
+        acquire();
+}
+
+void pm_qos::write_metrics(metrics_writer& writer) const
+{
+    writer.counter("joycond_pm_qos_acquired_total", "Times the cpu latency request was taken", "",
+                   stats.acquired.get());
+    writer.counter("joycond_pm_qos_released_total", "Times the cpu latency request was dropped", "",
+                   stats.released.get());
+}
+
+//public
+pm_qos::pm_qos(epoll_mgr& epoll_manager, const joycond_config& config, metrics_registry& metrics) :
+    epoll_manager(epoll_manager),
+    metrics(metrics),
+    latency_us(config.pm_qos_latency_us),
+    idle_ns(config.pm_qos_idle_s * 1000000000ULL),
+    active(false),
+    qos_fd(-1),
+    idle_timer(0),
+    held(false),
+    wake_pending(false),
+    last_input_ns(0),
+    wake_fd(-1),
+    subscriber(nullptr),
+    stats()
+{
+    if (!is_enabled())
+        return;
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        std::cerr << "Failed to create pm_qos eventfd; " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    subscriber = std::make_shared<epoll_subscriber>(std::vector({wake_fd}),
+                                                    [=](int event_fd){handle_wake();},
+                                                    "pm_qos");
+    epoll_manager.add_subscriber(subscriber);
+    metrics.add_source(this, [this](metrics_writer& writer){write_metrics(writer);});
+}
+
+pm_qos::~pm_qos()
+{
+    if (!is_enabled())
+        return;
+
+    metrics.remove_source(this);
+    release();
+    epoll_manager.remove_subscriber(subscriber);
+    close(wake_fd);
+}
+
+void pm_qos::set_active(bool active)
+{
+    if (!is_enabled() || active == this->active)
+        return;
+
+    this->active = active;
+    if (active) {
+        last_input_ns.store(now_ns(), std::memory_order_relaxed);
+        acquire();
+    } else {
+        release();
+    }
+}
+
+void pm_qos::touch(uint64_t now_ns)
+{
+    uint64_t one = 1;
+
+    if (!is_enabled())
+        return;
+    if (now_ns - last_input_ns.load(std::memory_order_relaxed) < TOUCH_GRANULARITY_NS)
+        return;
+
+    last_input_ns.store(now_ns, std::memory_order_relaxed);
+    // Input after an idle release: have the owning loop take the request again
+    if (!held.load(std::memory_order_relaxed) && !wake_pending.exchange(true, std::memory_order_relaxed)) {
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            std::cerr << "Failed to wake pm_qos; " << strerror(errno) << std::endl;
+    }
+}
@@ -0,0 +1,188 @@
+#include "realtime.h"
+
+#include <cstring>
+#include <iostream>
+#include <malloc.h>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Deepest stack the relay path is expected to reach
+static const size_t STACK_PREFAULT = 256 * 1024;
+
+// Plain thread_locals of trivial type, so reading them from operator new never allocates
+static thread_local unsigned int section_depth = 0;
+static thread_local uint64_t section_allocations = 0;
+
+static void *counted_alloc(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr)
+        throw std::bad_alloc();
+    if (section_depth)
+        section_allocations++;
+    return ptr;
+}
+
+static void *counted_aligned_alloc(size_t size, std::align_val_t align)
+{
+    void *ptr = nullptr;
+    size_t alignment = static_cast<size_t>(align);
+
+    if (alignment < sizeof(void *))
+        alignment = sizeof(void *);
+    if (posix_memalign(&ptr, alignment, size ? size : 1))
+        throw std::bad_alloc();
+    if (section_depth)
+        section_allocations++;
+    return ptr;
+}
+
+// Touches the pages below the current frame; the main thread's stack only grows on demand,
+// mlockall() or not
+static void __attribute__((noinline)) prefault_stack()
+{
+    unsigned char stack[STACK_PREFAULT];
+
+    memset(stack, 0, sizeof(stack));
+    asm volatile("" : : "r"(stack) : "memory");
+}
+
+//public
+bool realtime_lock_memory()
+{
+#ifdef M_TRIM_THRESHOLD
+    // Freed memory stays in the heap instead of being unmapped and faulted back in later
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        std::cerr << "Failed to lock memory; " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool realtime_enter_thread(int priority)
+{
+    struct sched_param param = {};
+    int ret;
+
+    param.sched_priority = priority;
+    ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    prefault_stack();
+    if (ret) {
+        std::cerr << "Failed to set SCHED_FIFO priority " << priority << "; " << strerror(ret) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool realtime_leave_thread()
+{
+    struct sched_param param = {};
+
+    int ret = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    if (ret) {
+        std::cerr << "Failed to set SCHED_OTHER; " << strerror(ret) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+realtime_section::realtime_section()
+{
+    section_depth++;
+}
+
+realtime_section::~realtime_section()
+{
+    section_depth--;
+}
+
+uint64_t realtime_allocations()
+{
+    return section_allocations;
+}
+
+// Replacements for the global allocation functions, counting what the relay path allocates
+void *operator new(size_t size)
+{
+    return counted_alloc(size);
+}
+
+void *operator new[](size_t size)
+{
+    return counted_alloc(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return counted_alloc(size);
+    } catch (std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return counted_alloc(size);
+    } catch (std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+    return counted_aligned_alloc(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+    return counted_aligned_alloc(size, align);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept
+{
+    free(ptr);
+}
@@ -0,0 +1,240 @@
+#include "remap_profiles.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <stdlib.h>
+
+static std::string trim(std::string const &str)
+{
+    size_t first = str.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        return "";
+    return str.substr(first, str.find_last_not_of(" \t\r") - first + 1);
+}
+
+//private
+bool remap_profiles::parse_code(std::string const &name, unsigned int &type, unsigned int &code) const
+{
+    int ret;
+
+    if (name.rfind("ABS_", 0) == 0)
+        type = EV_ABS;
+    else if (name.rfind("BTN_", 0) == 0 || name.rfind("KEY_", 0) == 0)
+        type = EV_KEY;
+    else
+        return false;
+
+    ret = libevdev_event_code_from_name(type, name.c_str());
+    if (ret < 0)
+        return false;
+    code = ret;
+    return true;
+}
+
+bool remap_profiles::parse_profile(std::string const &path)
+{
+    std::ifstream file(path);
+    struct profile prof;
+    std::string line;
+    unsigned int lineno = 0;
+
+    if (!file.is_open()) {
+        std::cerr << "Failed to open remap profile " << path << std::endl;
+        return false;
+    }
+    prof.name = path;
+
+    while (std::getline(file, line)) {
+        lineno++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            std::cerr << path << ":" << lineno << ": expected 'key = value'\n";
+            return false;
+        }
+        std::string key = trim(line.substr(0, eq));
+        std::string val = trim(line.substr(eq + 1));
+
+        if (key == "model") {
+            if (val == "procon")
+                prof.models.push_back(phys_ctlr::Model::Procon);
+            else if (val == "snescon")
+                prof.models.push_back(phys_ctlr::Model::Snescon);
+            else if (val == "left_joycon")
+                prof.models.push_back(phys_ctlr::Model::Left_Joycon);
+            else if (val == "right_joycon")
+                prof.models.push_back(phys_ctlr::Model::Right_Joycon);
+            else {
+                std::cerr << path << ":" << lineno << ": unknown model " << val << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (key == "busy_poll") {
+            char *end;
+            unsigned long us = strtoul(val.c_str(), &end, 10);
+            if (val.empty() || *end != '\0' || us > 999999) {
+                std::cerr << path << ":" << lineno << ": invalid busy_poll " << val << std::endl;
+                return false;
+            }
+            prof.busy_poll_us = us;
+            continue;
+        }
+        if (key == "max_rate") {
+            char *end;
+            unsigned long hz = strtoul(val.c_str(), &end, 10);
+            if (val.empty() || *end != '\0' || hz > 100000) {
+                std::cerr << path << ":" << lineno << ": invalid max_rate " << val << std::endl;
+                return false;
+            }
+            prof.max_rate_hz = hz;
+            continue;
+        }
+        if (key == "mac") {
+            std::transform(val.begin(), val.end(), val.begin(), ::tolower);
+            prof.macs.push_back(val);
+            continue;
+        }
+
+        struct rule r = { 0 };
+        if (!parse_code(key, r.type, r.code)) {
+            std::cerr << path << ":" << lineno << ": unknown event code " << key << std::endl;
+            return false;
+        }
+        if (val == "none") {
+            r.to_type = r.type;
+            r.to_code = r.code;
+            r.scale = 0;
+        } else {
+            r.scale = 1;
+            if (val[0] == '-') {
+                r.scale = -1;
+                val = val.substr(1);
+            }
+            if (!parse_code(val, r.to_type, r.to_code)) {
+                std::cerr << path << ":" << lineno << ": unknown event code " << val << std::endl;
+                return false;
+            }
+        }
+        prof.rules.push_back(r);
+    }
+
+    if (prof.models.empty() && prof.macs.empty()) {
+        std::cerr << path << ": profile has no model or mac to match; ignoring it\n";
+        return false;
+    }
+    profiles.push_back(prof);
+    return true;
+}
+
+// Model profiles come first so that a MAC specific profile can override them
+std::vector<const struct remap_profiles::profile *> remap_profiles::matching_profiles(phys_ctlr &phys) const
+{
+    std::vector<const struct profile *> matches;
+    std::string mac = phys.get_mac_addr();
+
+    std::transform(mac.begin(), mac.end(), mac.begin(), ::tolower);
+    for (auto& prof : profiles) {
+        if (std::find(prof.models.begin(), prof.models.end(), phys.get_model()) != prof.models.end())
+            matches.push_back(&prof);
+    }
+    for (auto& prof : profiles) {
+        if (mac != "" && std::find(prof.macs.begin(), prof.macs.end(), mac) != prof.macs.end())
+            matches.push_back(&prof);
+    }
+    return matches;
+}
+
+//public
+remap_profiles::remap_profiles() :
+    profiles()
+{
+}
+
+remap_profiles::~remap_profiles()
+{
+}
+
+void remap_profiles::load(std::string const &dir)
+{
+    std::vector<std::string> paths;
+    struct dirent *entry;
+    DIR *dirp;
+
+    dirp = opendir(dir.c_str());
+    if (!dirp) {
+        std::cout << "No remap profiles loaded; cannot open " << dir << std::endl;
+        return;
+    }
+    while ((entry = readdir(dirp)) != NULL) {
+        std::string name(entry->d_name);
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".conf") == 0)
+            paths.push_back(dir + "/" + name);
+    }
+    closedir(dirp);
+
+    // Apply profiles in a predictable order
+    std::sort(paths.begin(), paths.end());
+    for (auto& path : paths) {
+        if (parse_profile(path))
+            std::cout << "Loaded remap profile " << path << std::endl;
+    }
+}
+
+// Target codes have to be enabled before the uinput device is created
+void remap_profiles::enable_targets(struct libevdev *virt_evdev, phys_ctlr &phys) const
+{
+    for (auto prof : matching_profiles(phys)) {
+        for (auto& r : prof->rules) {
+            if (r.scale && r.to_type == EV_KEY)
+                libevdev_enable_event_code(virt_evdev, EV_KEY, r.to_code, NULL);
+        }
+    }
+}
+
+void remap_profiles::compile(remap_table &table, const remap_table &base, phys_ctlr &phys,
+                             const struct libevdev *virt_evdev) const
+{
+    table = base;
+
+    for (auto prof : matching_profiles(phys)) {
+        std::cout << "Applying remap profile " << prof->name << std::endl;
+        for (auto& r : prof->rules) {
+            if (!r.scale) {
+                table.drop(r.type, r.code);
+            } else if (!libevdev_has_event_code(virt_evdev, r.to_type, r.to_code)) {
+                std::cerr << prof->name << ": virtual device lacks " <<
+                             libevdev_event_code_get_name(r.to_type, r.to_code) << "; rule ignored\n";
+            } else {
+                table.map(r.type, r.code, r.to_type, r.to_code, r.scale);
+            }
+        }
+    }
+}
+
+unsigned int remap_profiles::busy_poll_us(phys_ctlr &phys, unsigned int default_us) const
+{
+    unsigned int us = default_us;
+
+    for (auto prof : matching_profiles(phys)) {
+        if (prof->busy_poll_us >= 0)
+            us = prof->busy_poll_us;
+    }
+    return us;
+}
+
+unsigned int remap_profiles::max_rate_hz(phys_ctlr &phys, unsigned int default_hz) const
+{
+    unsigned int hz = default_hz;
+
+    for (auto prof : matching_profiles(phys)) {
+        if (prof->max_rate_hz >= 0)
+            hz = prof->max_rate_hz;
+    }
+    return hz;
+}
@@ -0,0 +1,107 @@
+#include "rumble_scheduler.h"
+
+#include <iostream>
+#include <time.h>
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//public
+rumble_scheduler::rumble_scheduler(epoll_mgr& epoll_manager, unsigned int rate_hz) :
+    epoll_manager(epoll_manager),
+    fd(-1),
+    min_interval_ns(rate_hz ? 1000000000ULL / rate_hz : 0),
+    last_write_ns(0),
+    pending(),
+    count(0),
+    flush_timer(0),
+    counters()
+{
+}
+
+rumble_scheduler::~rumble_scheduler()
+{
+    if (flush_timer)
+        epoll_manager.cancel_timer(flush_timer);
+}
+
+void rumble_scheduler::set_fd(int fd)
+{
+    if (flush_timer) {
+        epoll_manager.cancel_timer(flush_timer);
+        flush_timer = 0;
+    }
+    counters.dropped.add(count);
+    count = 0;
+    // The old fd may be closed as soon as we let go of it
+    if (this->fd >= 0 && this->fd != fd)
+        epoll_manager.flush_writes();
+    this->fd = fd;
+}
+
+void rumble_scheduler::queue(struct input_event const &ev)
+{
+    counters.commands.add();
+
+    // Only the latest play/stop (or gain) of an effect still waiting matters
+    for (unsigned int i = 0; i < count; i++) {
+        if (pending[i].code == ev.code) {
+            pending[i].value = ev.value;
+            counters.dropped.add();
+            return;
+        }
+    }
+
+    if (count == MAX_PENDING)
+        flush();
+    pending[count++] = ev;
+
+    if (flush_timer)
+        return;
+
+    uint64_t now = now_ns();
+    if (!min_interval_ns || now - last_write_ns >= min_interval_ns)
+        flush();
+    else
+        flush_timer = epoll_manager.add_timer(last_write_ns + min_interval_ns - now, [this](){
+            flush_timer = 0;
+            flush();
+        });
+}
+
+// Writes everything waiting in one go; evdev takes several events per write()
+void rumble_scheduler::flush()
+{
+    if (flush_timer) {
+        epoll_manager.cancel_timer(flush_timer);
+        flush_timer = 0;
+    }
+    if (!count)
+        return;
+
+    if (fd >= 0) {
+        ssize_t len = count * sizeof(struct input_event);
+        if (epoll_manager.submit_write(fd, pending, len) != len)
+            std::cerr << "Failed to forward EV_FF to phys\n";
+        counters.writes.add();
+    } else {
+        counters.dropped.add(count);
+    }
+    last_write_ns = now_ns();
+    count = 0;
+}
+
+void rumble_scheduler::write_metrics(metrics_writer& writer, std::string const &labels) const
+{
+    writer.counter("joycond_rumble_commands_total", "EV_FF play, stop and gain commands sent to the controller",
+                   labels, counters.commands.get());
+    writer.counter("joycond_rumble_writes_total", "Writes of rumble commands to the controller", labels,
+                   counters.writes.get());
+    writer.counter("joycond_rumble_dropped_total", "Rumble commands replaced by a later one before being written",
+                   labels, counters.dropped.get());
+}
@@ -0,0 +1,101 @@
+#include "state_export.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+//public
+state_export::state_export() :
+    path(),
+    state(nullptr)
+{
+}
+
+state_export::~state_export()
+{
+    close();
+}
+
+bool state_export::open(std::string const &name)
+{
+    int fd;
+    void *map;
+
+    if (mkdir(JOYCOND_SHM_DIR, 0755) && errno != EEXIST) {
+        std::cerr << "Failed to create " JOYCOND_SHM_DIR ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    path = std::string(JOYCOND_SHM_DIR "/") + name;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to create " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(struct joycond_shm_state))) {
+        std::cerr << "Failed to size " << path << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+
+    map = mmap(NULL, sizeof(struct joycond_shm_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map " << path << ": " << strerror(errno) << std::endl;
+        unlink(path.c_str());
+        return false;
+    }
+
+    state = static_cast<struct joycond_shm_state *>(map);
+    state->magic = JOYCOND_SHM_MAGIC;
+    state->version = JOYCOND_SHM_VERSION;
+    std::cout << "Exporting controller state to " << path << std::endl;
+    return true;
+}
+
+void state_export::close()
+{
+    if (!state)
+        return;
+
+    munmap(state, sizeof(struct joycond_shm_state));
+    unlink(path.c_str());
+    state = nullptr;
+}
+
+void state_export::publish(struct input_event const *events, unsigned int count)
+{
+    struct timespec now;
+    uint32_t seq;
+
+    if (!state)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    seq = __atomic_load_n(&state->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&state->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (unsigned int i = 0; i < count; i++) {
+        struct input_event const &ev = events[i];
+
+        if (ev.type == EV_KEY && ev.code < KEY_CNT) {
+            if (ev.value)
+                state->buttons[ev.code / 64] |= 1ULL << (ev.code % 64);
+            else
+                state->buttons[ev.code / 64] &= ~(1ULL << (ev.code % 64));
+        } else if (ev.type == EV_ABS && ev.code < ABS_CNT) {
+            state->axes[ev.code] = ev.value;
+        }
+    }
+    state->timestamp_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    state->frames++;
+
+    __atomic_store_n(&state->seq, seq + 2, __ATOMIC_RELEASE);
+}
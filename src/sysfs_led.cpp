@@ -0,0 +1,76 @@
+#include "sysfs_led.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+//private
+bool sysfs_led::write_attr(int fd, std::string const &value)
+{
+    // sysfs attributes are always written whole from the start
+    return pwrite(fd, value.data(), value.size(), 0) == (ssize_t)value.size();
+}
+
+//public
+sysfs_led::sysfs_led() :
+    brightness_fd(-1),
+    trigger_fd(-1),
+    brightness(-1),
+    blinking(false)
+{
+}
+
+sysfs_led::~sysfs_led()
+{
+    if (brightness_fd >= 0)
+        close(brightness_fd);
+    if (trigger_fd >= 0)
+        close(trigger_fd);
+}
+
+bool sysfs_led::open(std::string const &path, bool with_trigger)
+{
+    if (brightness_fd < 0)
+        brightness_fd = ::open((path + "/brightness").c_str(), O_WRONLY | O_CLOEXEC);
+    if (brightness_fd < 0)
+        return false;
+    if (with_trigger && trigger_fd < 0)
+        trigger_fd = ::open((path + "/trigger").c_str(), O_WRONLY | O_CLOEXEC);
+    return !with_trigger || trigger_fd >= 0;
+}
+
+sysfs_led::Result sysfs_led::set_brightness(unsigned int value)
+{
+    if ((int)value == brightness)
+        return Result::Unchanged;
+
+    // A nonzero brightness only changes how bright a blinking LED blinks; writing 0 is what removes
+    // the trigger, so do that first when the LED should end up lit
+    if (blinking && value) {
+        if (!write_attr(brightness_fd, "0"))
+            return Result::Failed;
+        blinking = false;
+    }
+
+    if (!write_attr(brightness_fd, std::to_string(value))) {
+        brightness = -1;
+        return Result::Failed;
+    }
+    brightness = value;
+    if (!value)
+        blinking = false;
+    return Result::Written;
+}
+
+sysfs_led::Result sysfs_led::start_blink()
+{
+    if (blinking)
+        return Result::Unchanged;
+
+    if (!write_attr(trigger_fd, "timer"))
+        return Result::Failed;
+    blinking = true;
+    brightness = -1;
+    return Result::Written;
+}
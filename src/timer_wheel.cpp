@@ -0,0 +1,99 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+//private
+
+//public
+timer_wheel::timer_wheel() :
+    slots(),
+    count(0),
+    current_tick(0),
+    next_seq(1)
+{
+    for (auto& slot : slots)
+        slot.reserve(4);
+}
+
+timer_wheel::~timer_wheel()
+{
+}
+
+uint64_t timer_wheel::add(uint64_t expiry_ns, std::function<void()> callback)
+{
+    uint64_t tick = std::max(expiry_ns / TICK_NS, current_tick);
+    unsigned int slot = tick % SLOTS;
+    uint64_t id = next_seq++ * SLOTS + slot;
+
+    slots[slot].push_back({id, expiry_ns, callback});
+    count++;
+    return id;
+}
+
+bool timer_wheel::cancel(uint64_t id)
+{
+    auto& slot = slots[id % SLOTS];
+
+    for (auto entry = slot.begin(); entry != slot.end(); ++entry) {
+        if (entry->id == id) {
+            slot.erase(entry);
+            count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void timer_wheel::expire(uint64_t now_ns, std::vector<struct timer>& due)
+{
+    uint64_t now_tick = now_ns / TICK_NS;
+    // After a long idle stretch every slot has to be looked at once, but never more than once
+    uint64_t last_tick = std::min(now_tick, current_tick + SLOTS - 1);
+    size_t first_due = due.size();
+
+    for (uint64_t tick = current_tick; tick <= last_tick; tick++) {
+        auto& slot = slots[tick % SLOTS];
+
+        for (auto entry = slot.begin(); entry != slot.end();) {
+            if (entry->expiry_ns <= now_ns) {
+                count--;
+                due.push_back(std::move(*entry));
+                entry = slot.erase(entry);
+            } else {
+                ++entry;
+            }
+        }
+    }
+    current_tick = now_tick;
+
+    std::stable_sort(due.begin() + first_due, due.end(),
+                     [](struct timer const &a, struct timer const &b){ return a.expiry_ns < b.expiry_ns; });
+}
+
+std::optional<uint64_t> timer_wheel::next_expiry() const
+{
+    std::optional<uint64_t> next;
+
+    if (!count)
+        return next;
+
+    // The first slot holding a timer for its own lap holds the earliest timer
+    for (uint64_t tick = current_tick; tick < current_tick + SLOTS; tick++) {
+        for (auto& entry : slots[tick % SLOTS]) {
+            if (std::max(entry.expiry_ns / TICK_NS, current_tick) == tick &&
+                (!next || entry.expiry_ns < *next))
+                next = entry.expiry_ns;
+        }
+        if (next)
+            return next;
+    }
+
+    // Everything is at least a full lap away
+    for (auto& slot : slots) {
+        for (auto& entry : slot) {
+            if (!next || entry.expiry_ns < *next)
+                next = entry.expiry_ns;
+        }
+    }
+    return next;
+}
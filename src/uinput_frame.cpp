@@ -0,0 +1,189 @@
+#include "uinput_frame.h"
+
+#include <cstring>
+#include <iostream>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//private
+void uinput_frame::flush()
+{
+    if (!count)
+        return;
+
+    ssize_t len = count * sizeof(struct input_event);
+    ssize_t ret = epoll_manager.submit_write(uifd, events, len);
+    if (ret != len)
+        std::cerr << "Failed to write frame to uinput; ret=" << ret << " " << strerror(errno) << std::endl;
+
+    counters.writes.add();
+    counters.events.add(count);
+    if (exporter)
+        exporter->publish(events, count);
+    count = 0;
+}
+
+//public
+uinput_frame::uinput_frame(int uifd, epoll_mgr& epoll_manager) :
+    uifd(uifd),
+    epoll_manager(epoll_manager),
+    events(),
+    count(0),
+    counters(),
+    exporter(nullptr),
+    frame_started(false),
+    kernel_ns(0),
+    dequeue_ns(0),
+    latency(),
+    min_interval_ns(0),
+    last_write_ns(0),
+    urgent(false),
+    flush_timer(0)
+{
+}
+
+uinput_frame::~uinput_frame()
+{
+    if (flush_timer)
+        epoll_manager.cancel_timer(flush_timer);
+}
+
+void uinput_frame::set_max_rate(unsigned int hz)
+{
+    min_interval_ns = hz ? 1000000000ULL / hz : 0;
+}
+
+// Every event of an evdev frame carries the same kernel timestamp; the first one seen counts
+void uinput_frame::note_timestamp(struct input_event const &ev)
+{
+    if (frame_started)
+        return;
+
+    frame_started = true;
+    kernel_ns = ev.input_event_sec * 1000000000ULL + ev.input_event_usec * 1000ULL;
+    dequeue_ns = epoll_manager.get_wakeup_ns();
+}
+
+void uinput_frame::add_event(struct input_event const &ev, unsigned int source_type)
+{
+    note_timestamp(ev);
+
+    if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+        sync();
+        return;
+    }
+
+    if (min_interval_ns) {
+        if (ev.type != EV_ABS || source_type != EV_ABS) {
+            urgent = true;
+        } else {
+            // Only the latest value of an axis still waiting to go out matters
+            for (unsigned int i = 0; i < count; i++) {
+                if (events[i].type == EV_ABS && events[i].code == ev.code) {
+                    events[i].value = ev.value;
+                    return;
+                }
+            }
+        }
+    }
+
+    // A frame this large is not expected from hid-nintendo; just split it
+    if (count == MAX_EVENTS)
+        flush();
+
+    struct input_event& out = events[count++];
+    out.type = ev.type;
+    out.code = ev.code;
+    out.value = ev.value;
+}
+
+void uinput_frame::sync()
+{
+    if (min_interval_ns && !urgent) {
+        uint64_t now = now_ns();
+
+        if (now - last_write_ns < min_interval_ns) {
+            counters.coalesced.add();
+            if (!flush_timer)
+                flush_timer = epoll_manager.add_timer(last_write_ns + min_interval_ns - now, [this](){
+                    flush_timer = 0;
+                    write_frame();
+                });
+            return;
+        }
+    }
+    write_frame();
+}
+
+// Ends whatever has been collected with a SYN_REPORT and writes it out
+void uinput_frame::write_frame()
+{
+    if (flush_timer) {
+        epoll_manager.cancel_timer(flush_timer);
+        flush_timer = 0;
+    }
+    urgent = false;
+
+    if (count == MAX_EVENTS)
+        flush();
+
+    struct input_event& ev = events[count++];
+    ev.type = EV_SYN;
+    ev.code = SYN_REPORT;
+    ev.value = 0;
+
+    flush();
+    counters.frames.add();
+    uint64_t written_ns = now_ns();
+    last_write_ns = written_ns;
+
+    if (frame_started) {
+        // Timestamps from before the phys fd switched to CLOCK_MONOTONIC can't be compared
+        if (kernel_ns <= dequeue_ns && dequeue_ns <= written_ns) {
+            latency[Kernel_To_Dequeue].record(dequeue_ns - kernel_ns);
+            latency[Kernel_To_Write].record(written_ns - kernel_ns);
+        }
+        if (dequeue_ns <= written_ns)
+            latency[Dequeue_To_Write].record(written_ns - dequeue_ns);
+        frame_started = false;
+    }
+}
+
+void uinput_frame::print_stats() const
+{
+    static char const *const names[Num_Latencies] = { "kernel->dequeue", "dequeue->write", "kernel->write" };
+
+    std::cout << "Relayed " << counters.frames.get() << " frames (" << counters.events.get() << " events) in "
+              << counters.writes.get() << " uinput writes\n";
+    for (unsigned int i = 0; i < Num_Latencies; i++) {
+        if (!latency[i].get_count())
+            continue;
+        std::cout << "  " << names[i] << " latency us: p50=" << latency[i].percentile(50) / 1000
+                  << " p99=" << latency[i].percentile(99) / 1000
+                  << " p99.9=" << latency[i].percentile(99.9) / 1000 << std::endl;
+    }
+}
+
+void uinput_frame::write_metrics(metrics_writer& writer, std::string const &labels) const
+{
+    static char const *const names[Num_Latencies] = { "kernel_to_dequeue", "dequeue_to_write", "kernel_to_write" };
+
+    writer.counter("joycond_frames_relayed_total", "Input frames written to the virtual controller", labels,
+                   counters.frames.get());
+    writer.counter("joycond_events_relayed_total", "Input events written to the virtual controller", labels,
+                   counters.events.get());
+    writer.counter("joycond_uinput_writes_total", "write() calls on the uinput fd", labels, counters.writes.get());
+    writer.counter("joycond_frames_coalesced_total", "ABS-only frames held back by the rate limit and merged into a later one",
+                   labels, counters.coalesced.get());
+    for (unsigned int i = 0; i < Num_Latencies; i++)
+        writer.summary("joycond_latency_seconds", "Input latency from the kernel timestamp through the uinput write",
+                       labels + ",stage=\"" + names[i] + "\"", latency[i]);
+}
@@ -11,75 +11,103 @@
 #include <unistd.h>
 #include <vector>
 
+static const remap_table& builtin_remap(std::shared_ptr<phys_ctlr> phys)
+{
+    if (phys->get_model() == phys_ctlr::Model::Left_Joycon)
+        return phys->is_serial_ctlr() ? remap_combined_left_serial : remap_combined_left;
+    return phys->is_serial_ctlr() ? remap_combined_right_serial : remap_combined_right;
+}
+
 //private
-void virt_ctlr_combined::relay_events(std::shared_ptr<phys_ctlr> phys)
+void virt_ctlr_combined::relay_event(std::shared_ptr<phys_ctlr> const &phys, const remap_table& remap,
+                                     struct input_event &ev)
 {
-    struct input_event ev;
-    struct libevdev *evdev = phys->get_evdev();
-    bool is_serial;
+    if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+        frame.note_timestamp(ev);
+        end_frame(phys);
+        return;
+    }
 
-    int ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-    while (ret == LIBEVDEV_READ_STATUS_SYNC || ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-        if (ret == LIBEVDEV_READ_STATUS_SYNC) {
-            std::cout << "handle sync\n";
-            while (ret == LIBEVDEV_READ_STATUS_SYNC) {
-                libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-            }
-        } else if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-            is_serial = phys->is_serial_ctlr();
-            /* First remap the SL and SR buttons on each physical controller */
-            if (phys == physl && ev.type == EV_KEY && (ev.code == BTN_TR || ev.code == BTN_TR2)) {
-                if (!is_serial)
-                    libevdev_uinput_write_event(uidev, ev.type, ev.code == BTN_TR ? BTN_TRIGGER_HAPPY1 : BTN_TRIGGER_HAPPY2, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            } else if (phys == physr && ev.type == EV_KEY && (ev.code == BTN_TL || ev.code == BTN_TL2)) {
-                if (!is_serial)
-                    libevdev_uinput_write_event(uidev, ev.type, ev.code == BTN_TL ? BTN_TRIGGER_HAPPY3 : BTN_TRIGGER_HAPPY4, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            }
+    // A second frame from the held side must not share a SYN_REPORT with the first one; a press and its
+    // release merged into one frame would both be lost
+    if (merge_timer && phys.get() == held_side)
+        release_held_frame();
+    unsigned int source_type = ev.type;
+    if (remap.apply(ev))
+        frame.add_event(ev, source_type);
+}
 
-#if defined(ANDROID) || defined(__ANDROID__)
-            /* Second remap the ZL and ZR buttons to analog trigger and map the DPAD to a HAT on android */
-            if (phys == physl && ev.type == EV_KEY && ev.code == BTN_TL2) {
-                libevdev_uinput_write_event(uidev, EV_ABS, ABS_Z, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            } else if (phys == physr && ev.type == EV_KEY && ev.code == BTN_TR2) {
-                libevdev_uinput_write_event(uidev, EV_ABS, ABS_RZ, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            }
-
-            if (ev.type == EV_KEY) {
-                switch (ev.code) {
-                    case BTN_DPAD_UP:
-                        libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0Y, -ev.value);
-                        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                        continue;
-                    case BTN_DPAD_DOWN:
-                        libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0Y, ev.value);
-                        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                        continue;
-                    case BTN_DPAD_LEFT:
-                        libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0X, -ev.value);
-                        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                        continue;
-                    case BTN_DPAD_RIGHT:
-                        libevdev_uinput_write_event(uidev, EV_ABS, ABS_HAT0X, ev.value);
-                        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                        continue;
-                    default:
-                        break;
-                }
-            }
-#endif
-            libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-        }
-        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+// With frame merging enabled, the first side's frame is held back until the other side's frame
+// completes or the merge window runs out, and both go out behind a single SYN_REPORT.
+void virt_ctlr_combined::end_frame(std::shared_ptr<phys_ctlr> const &phys)
+{
+    if (!merge_window_us || !physl || !physr) {
+        frame.sync();
+        return;
+    }
+
+    // The same side completing another frame starts a new merge instead of joining the held one
+    if (merge_timer && phys.get() == held_side)
+        release_held_frame();
+
+    if (!merge_timer) {
+        held_side = phys.get();
+        merge_timer = epoll_manager.add_timer(merge_window_us * 1000ULL, [this](){handle_merge_timer();});
+        return;
     }
+
+    // The other side's frame completed the merge
+    release_held_frame();
+}
+
+void virt_ctlr_combined::handle_merge_timer()
+{
+    merge_timer = 0;
+    frame.sync();
+}
+
+void virt_ctlr_combined::release_held_frame()
+{
+    if (!merge_timer)
+        return;
+
+    epoll_manager.cancel_timer(merge_timer);
+    merge_timer = 0;
+    frame.sync();
+}
+
+// Reads budget events, and then the rest of the frame they end in: both sides share one uinput
+// frame, so the other side's SYN_REPORT would otherwise send half of this side's. Returns how many
+// it read.
+unsigned int virt_ctlr_combined::relay_events(std::shared_ptr<phys_ctlr> const &phys, const remap_table& remap,
+                                              unsigned int budget)
+{
+    struct input_event ev;
+    bool syncing = false;
+    bool frame_done = true;
+    unsigned int count;
+
+    for (count = 0; count < budget || !frame_done; count++) {
+        int ret = phys->next_event(ev);
+        if (ret != LIBEVDEV_READ_STATUS_SYNC && ret != LIBEVDEV_READ_STATUS_SUCCESS)
+            break;
+        if (ret == LIBEVDEV_READ_STATUS_SYNC && !syncing)
+            std::cout << "handle sync\n";
+        syncing = ret == LIBEVDEV_READ_STATUS_SYNC;
+        frame_done = ev.type == EV_SYN && ev.code == SYN_REPORT;
+        relay_event(phys, remap, ev);
+    }
+    return count;
+}
+
+// One turn's worth of input; a side with more than that gets another loop turn on its own fd
+bool virt_ctlr_combined::relay_turn(std::shared_ptr<phys_ctlr> const &phys, const remap_table& remap)
+{
+    unsigned int count = relay_events(phys, remap, phys_ctlr::EVENT_BUDGET);
+
+    if (count >= phys_ctlr::EVENT_BUDGET)
+        epoll_manager.defer(phys->get_fd());
+    return count > 0;
 }
 
 void virt_ctlr_combined::handle_uinput_event()
@@ -90,104 +118,113 @@ void virt_ctlr_combined::handle_uinput_event()
     while ((ret = read(get_uinput_fd(), &ev, sizeof(ev))) == sizeof(ev)) {
         switch (ev.type) {
             case EV_FF:
-                {
-                    struct input_event redirectedl = ev;
-                    struct input_event redirectedr = ev;
-
-                    if (!rumble_effects.count(ev.code)) {
-                        if (ev.code < FF_GAIN)
-                            std::cerr << "ERROR: ff_effect with id=" << ev.code << " is not in map\n";
-                    } else {
-                        redirectedl.code = rumble_effects[ev.code].first.id;
-                        redirectedr.code = rumble_effects[ev.code].second.id;
-                    }
-
-                    /* Just forward this FF event on to the actual devices */
-                    if (physl) {
-                        if (write(physl->get_fd(), &redirectedl, sizeof(redirectedl)) != sizeof(redirectedl))
-                            std::cerr << "Failed to forward EV_FF to physl\n";
-                    }
-                    if (physr) {
-                        if (write(physr->get_fd(), &redirectedr, sizeof(redirectedr)) != sizeof(redirectedr))
-                            std::cerr << "Failed to forward EV_FF to physr\n";
-                    }
+                /* FF_GAIN and FF_AUTOCENTER aren't effects; forward them as they are */
+                if (ev.code >= FF_GAIN) {
+                    if (physl)
+                        rumble_l.queue(ev);
+                    if (physr)
+                        rumble_r.queue(ev);
                     break;
                 }
 
+                if (ev.value)
+                    ff_counters.plays.add();
+                if (!effects.contains(ev.code)) {
+                    std::cerr << "ERROR: ff_effect with id=" << ev.code << " is not in table\n";
+                    break;
+                }
+                if (physl)
+                    effects.play(ev, LEFT, physl->get_fd(), ff_jobs, rumble_l);
+                if (physr)
+                    effects.play(ev, RIGHT, physr->get_fd(), ff_jobs, rumble_r);
+                break;
+
             case EV_UINPUT:
                 switch (ev.code) {
                     case UI_FF_UPLOAD:
                         {
                             struct uinput_ff_upload upload = { 0 };
-                            struct ff_effect effect = { 0 };
-                            struct ff_effect effect_l = { 0 };
-                            struct ff_effect effect_r = { 0 };
+                            int fds[ff_effect_table::MAX_SIDES] = { physl ? physl->get_fd() : -1,
+                                                                    physr ? physr->get_fd() : -1 };
+                            int16_t ids[ff_effect_table::MAX_SIDES];
 
                             upload.request_id = ev.value;
                             if (ioctl(get_uinput_fd(), UI_BEGIN_FF_UPLOAD, &upload))
                                 std::cerr << "Failed to get uinput_ff_upload: " << strerror(errno) << std::endl;
 
-                            effect = upload.effect;
-                            effect.id = -1;
-                            /* upload the effect to both devices */
-                            upload.retval = 0;
-                            if (physl) {
-                                if (ioctl(physl->get_fd(), EVIOCSFF, &effect) == -1)
-                                    upload.retval = errno;
-                                effect_l = effect;
-                            }
-
-                            if (physr) {
-                                /* reset effect */
-                                effect = upload.effect;
-                                effect.id = -1;
-                                if (ioctl(physr->get_fd(), EVIOCSFF, &effect) == -1)
-                                    upload.retval = errno;
-                                effect_r = effect;
-                            }
-
-                            upload.effect = effect;
-
-                            if (upload.retval)
-                                std::cerr << "UI_FF_UPLOAD failed: " << strerror(upload.retval) << std::endl;
-
-                            if (rumble_effects.count(effect.id))
-                                std::cerr << "WARNING: ff_effect already in map\n";
-                            rumble_effects[effect.id] = std::make_pair(effect_l, effect_r);
-
-                            if (ioctl(get_uinput_fd(), UI_END_FF_UPLOAD, &upload))
-                                std::cerr << "Failed to end uinput_ff_upload: " << strerror(errno) << std::endl;
-
+                            /* upload the effect to both devices, in place where they have it already; the
+                             * game waits until UI_END_FF_UPLOAD */
+                            for (unsigned int side = 0; side < ff_effect_table::MAX_SIDES; side++)
+                                ids[side] = effects.phys_id(upload.effect.id, side);
+                            ff_jobs.submit([this, upload, fds, ids]() mutable -> ff_pipeline::completion {
+                                int16_t uploaded[ff_effect_table::MAX_SIDES];
+
+                                upload.retval = 0;
+                                for (unsigned int side = 0; side < ff_effect_table::MAX_SIDES; side++) {
+                                    struct ff_effect effect = upload.effect;
+
+                                    uploaded[side] = ff_effect_table::NOT_UPLOADED;
+                                    if (fds[side] < 0)
+                                        continue;
+                                    effect.id = ids[side];
+                                    if (ioctl(fds[side], EVIOCSFF, &effect) == -1)
+                                        upload.retval = errno;
+                                    else
+                                        uploaded[side] = effect.id;
+                                }
+
+                                /* the game won't know the effect, so don't leave new copies of it behind */
+                                for (unsigned int side = 0; upload.retval && side < ff_effect_table::MAX_SIDES; side++) {
+                                    if (uploaded[side] >= 0 && ids[side] < 0)
+                                        ioctl(fds[side], EVIOCRMFF, uploaded[side]);
+                                }
+
+                                return [this, upload, uploaded]() mutable {
+                                    ff_counters.uploads.add();
+                                    if (upload.retval)
+                                        std::cerr << "UI_FF_UPLOAD failed: " << strerror(upload.retval) << std::endl;
+                                    else
+                                        effects.store(upload.effect.id, upload.effect, uploaded);
+
+                                    if (ioctl(get_uinput_fd(), UI_END_FF_UPLOAD, &upload))
+                                        std::cerr << "Failed to end uinput_ff_upload: " << strerror(errno) << std::endl;
+                                };
+                            });
                             break;
                         }
                     case UI_FF_ERASE:
                         {
                             struct uinput_ff_erase erase = { 0 };
+                            int fds[ff_effect_table::MAX_SIDES] = { physl ? physl->get_fd() : -1,
+                                                                    physr ? physr->get_fd() : -1 };
+                            int16_t ids[ff_effect_table::MAX_SIDES];
 
                             erase.request_id = ev.value;
                             if (ioctl(get_uinput_fd(), UI_BEGIN_FF_ERASE, &erase))
                                 std::cerr << "Failed to get uinput_ff_erase: " << strerror(errno) << std::endl;
 
-                            erase.retval = 0;
-                            if (physl) {
-                                if (ioctl(physl->get_fd(), EVIOCRMFF, erase.effect_id) == -1)
-                                    erase.retval = errno;
-                            }
-                            if (physr) {
-                                if (ioctl(physr->get_fd(), EVIOCRMFF, erase.effect_id) == -1)
-                                    erase.retval = errno;
-                            }
-
-                            if (erase.retval)
-                                std::cerr << "UI_FF_ERASE failed: " << strerror(erase.retval) << std::endl;
-                            else if (!rumble_effects.count(erase.effect_id))
-                                std::cerr << "WARNING: effect_id not in rumble_effects map\n";
-                            else
-                                rumble_effects.erase(erase.effect_id);
-
-                            if (ioctl(get_uinput_fd(), UI_END_FF_ERASE, &erase))
-                                std::cerr << "Failed to end uinput_ff_erase: " << strerror(errno) << std::endl;
-
+                            if (!effects.contains(erase.effect_id))
+                                std::cerr << "WARNING: effect_id not in effect table\n";
+                            for (unsigned int side = 0; side < ff_effect_table::MAX_SIDES; side++)
+                                ids[side] = effects.phys_id(erase.effect_id, side);
+                            ff_jobs.submit([this, erase, fds, ids]() mutable -> ff_pipeline::completion {
+                                erase.retval = 0;
+                                for (unsigned int side = 0; side < ff_effect_table::MAX_SIDES; side++) {
+                                    if (fds[side] >= 0 && ids[side] >= 0 && ioctl(fds[side], EVIOCRMFF, ids[side]) == -1)
+                                        erase.retval = errno;
+                                }
+
+                                return [this, erase]() mutable {
+                                    ff_counters.erases.add();
+                                    if (erase.retval)
+                                        std::cerr << "UI_FF_ERASE failed: " << strerror(erase.retval) << std::endl;
+                                    else
+                                        effects.erase(erase.effect_id);
+
+                                    if (ioctl(get_uinput_fd(), UI_END_FF_ERASE, &erase))
+                                        std::cerr << "Failed to end uinput_ff_erase: " << strerror(errno) << std::endl;
+                                };
+                            });
                             break;
                         }
                     default:
@@ -214,18 +251,52 @@ void virt_ctlr_combined::handle_uinput_event()
     }
 }
 
+void virt_ctlr_combined::write_metrics(metrics_writer& writer) const
+{
+    std::string labels = metrics_writer::label("ctlr", name) + ",type=\"combined\"";
+
+    frame.write_metrics(writer, labels);
+    writer.counter("joycond_ff_uploads_total", "Force feedback effects uploaded to the virtual controller", labels,
+                   ff_counters.uploads.get());
+    writer.counter("joycond_ff_erases_total", "Force feedback effects erased from the virtual controller", labels,
+                   ff_counters.erases.get());
+    writer.counter("joycond_ff_plays_total", "Force feedback effects started on the virtual controller", labels,
+                   ff_counters.plays.get());
+    rumble_l.write_metrics(writer, labels + ",side=\"left\"");
+    rumble_r.write_metrics(writer, labels + ",side=\"right\"");
+}
+
 //public
-virt_ctlr_combined::virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl, std::shared_ptr<phys_ctlr> physr, epoll_mgr& epoll_manager) :
+virt_ctlr_combined::virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl, std::shared_ptr<phys_ctlr> physr,
+                                       epoll_mgr& epoll_manager, worker_thread& ff_worker,
+                                       const remap_profiles& remaps,
+                                       const joycond_config& config, metrics_registry& metrics) :
     physl(physl),
     physr(physr),
     epoll_manager(epoll_manager),
+    remaps(remaps),
     subscriber(nullptr),
     virt_evdev(nullptr),
     uidev(nullptr),
     uifd(-1),
-    rumble_effects(),
+    frame(-1, epoll_manager),
+    state(),
+    metrics(metrics),
+    name(),
+    ff_counters(),
+    effects(),
+    rumble_l(epoll_manager, config.rumble_rate_hz),
+    rumble_r(epoll_manager, config.rumble_rate_hz),
     left_mac(physl->get_mac_addr()),
-    right_mac(physr->get_mac_addr())
+    right_mac(physr->get_mac_addr()),
+    remap_l(),
+    remap_r(),
+    merge_window_us(config.merge_window_us),
+    merge_timer(0),
+    held_side(nullptr),
+    busy_poll_ns(std::max(remaps.busy_poll_us(*physl, config.busy_poll_us),
+                          remaps.busy_poll_us(*physr, config.busy_poll_us)) * 1000ULL),
+    ff_jobs(epoll_manager, ff_worker)
 {
     int ret;
 
@@ -325,6 +396,10 @@ virt_ctlr_combined::virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl, std::sh
     libevdev_enable_event_code(virt_evdev, EV_LED, 2, NULL);
     libevdev_enable_event_code(virt_evdev, EV_LED, 3, NULL);
 
+    // Make room for whatever the user's remap profiles map to
+    remaps.enable_targets(virt_evdev, *physl);
+    remaps.enable_targets(virt_evdev, *physr);
+
     ret = libevdev_uinput_create_from_device(virt_evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
     if (ret) {
         std::cerr << "Failed to create libevdev_uinput; " << ret << std::endl;
@@ -333,14 +408,40 @@ virt_ctlr_combined::virt_ctlr_combined(std::shared_ptr<phys_ctlr> physl, std::sh
 
     int flags = fcntl(get_uinput_fd(), F_GETFL, 0);
     fcntl(get_uinput_fd(), F_SETFL, flags | O_NONBLOCK);
+    frame.set_uinput_fd(get_uinput_fd());
+    rumble_l.set_fd(physl->get_fd());
+    rumble_r.set_fd(physr->get_fd());
+    // Either side being unlimited leaves the whole controller unlimited
+    unsigned int rate_l = remaps.max_rate_hz(*physl, config.max_rate_hz);
+    unsigned int rate_r = remaps.max_rate_hz(*physr, config.max_rate_hz);
+    frame.set_max_rate(rate_l && rate_r ? std::max(rate_l, rate_r) : 0);
+    const char *devnode = libevdev_uinput_get_devnode(uidev);
+    if (devnode)
+        name = basename(devnode);
+    effects.size_from_device(devnode);
+    if (config.export_state && !name.empty() && state.open(name))
+        frame.set_state_export(&state);
+    metrics.add_source(this, [this](metrics_writer& writer){write_metrics(writer);});
+    remaps.compile(remap_l, builtin_remap(physl), *physl, virt_evdev);
+    remaps.compile(remap_r, builtin_remap(physr), *physr, virt_evdev);
 
     subscriber = std::make_shared<epoll_subscriber>(std::vector({get_uinput_fd()}),
-                                                    [=](int event_fd){handle_events(event_fd);});
+                                                    [=](int event_fd){handle_events(event_fd);},
+                                                    "uinput");
     epoll_manager.add_subscriber(subscriber);
 }
 
 virt_ctlr_combined::~virt_ctlr_combined()
 {
+    metrics.remove_source(this);
+    if (merge_timer)
+        epoll_manager.cancel_timer(merge_timer);
+    // Answer outstanding uploads while the uinput device is still there
+    ff_jobs.drain();
+    // A stop still waiting for its slot must not leave the controllers rumbling
+    rumble_l.flush();
+    rumble_r.flush();
+    frame.print_stats();
     epoll_manager.remove_subscriber(subscriber);
 
     libevdev_uinput_destroy(uidev);
@@ -350,14 +451,27 @@ virt_ctlr_combined::~virt_ctlr_combined()
 
 void virt_ctlr_combined::handle_events(int fd)
 {
-    if (physl && fd == physl->get_fd())
-        relay_events(physl);
-    else if (physr && fd == physr->get_fd())
-        relay_events(physr);
-    else if (fd == get_uinput_fd())
+    if (fd == get_uinput_fd()) {
         handle_uinput_event();
-    else
+        return;
+    }
+
+    bool got_events;
+    if (physl && fd == physl->get_fd()) {
+        got_events = relay_turn(physl, remap_l);
+    } else if (physr && fd == physr->get_fd()) {
+        got_events = relay_turn(physr, remap_r);
+    } else {
         std::cerr << "fd=" << fd << " is an invalid fd for this combined controller\n";
+        return;
+    }
+    // Busy polling covers both Joy-Cons, since the other side's report usually follows shortly
+    if (got_events && busy_poll_ns) {
+        if (physl)
+            epoll_manager.busy_poll(physl->get_fd(), busy_poll_ns);
+        if (physr)
+            epoll_manager.busy_poll(physr->get_fd(), busy_poll_ns);
+    }
 }
 
 bool virt_ctlr_combined::contains_phys_ctlr(std::shared_ptr<phys_ctlr> const ctlr) const
@@ -393,12 +507,21 @@ int virt_ctlr_combined::get_uinput_fd()
 
 void virt_ctlr_combined::remove_phys_ctlr(const std::shared_ptr<phys_ctlr> phys)
 {
+    // Don't leave the other side's events waiting on a frame that will never complete
+    release_held_frame();
+    // Nor an ff job using the fd of the controller going away
+    ff_jobs.drain();
+
     if (phys == physl) {
         std::cout << "Removing left joy-con from virtual combined controller\n";
         physl = nullptr;
+        rumble_l.set_fd(-1);
+        effects.forget_side(LEFT);
     } else if (phys == physr) {
         std::cout << "Removing right joy-con from virtual combined controller\n";
         physr = nullptr;
+        rumble_r.set_fd(-1);
+        effects.forget_side(RIGHT);
     } else {
         std::cerr << "ERROR: Attempted to remove non-existant controller from combined joy-cons\n";
         exit(EXIT_FAILURE);
@@ -411,28 +534,20 @@ void virt_ctlr_combined::add_phys_ctlr(std::shared_ptr<phys_ctlr> phys)
         std::cout << "Re-adding left joy-con to virtual combined controller\n";
         physl = phys;
         left_mac = phys->get_mac_addr();
+        rumble_l.set_fd(phys->get_fd());
+        remaps.compile(remap_l, builtin_remap(phys), *phys, virt_evdev);
     } else if (phys->get_model() == phys_ctlr::Model::Right_Joycon && !physr) {
         std::cout << "Re-adding right joy-con to virtual combined controller\n";
         physr = phys;
         right_mac = phys->get_mac_addr();
+        rumble_r.set_fd(phys->get_fd());
+        remaps.compile(remap_r, builtin_remap(phys), *phys, virt_evdev);
     } else {
         std::cerr << "ERROR: Attempted to add invalid controller to combined joy-cons\n";
         exit(EXIT_FAILURE);
     }
 
-    // re-add all the ff_effects to the reconnected controller
-    for (auto& kv : rumble_effects) {
-        struct ff_effect* effect;
-
-        if (phys == physl)
-            effect = &kv.second.first;
-        else
-            effect = &kv.second.second;
-        effect->id = -1;
-
-        if (ioctl(phys->get_fd(), EVIOCSFF, effect) == -1)
-            std::cerr << "ERROR: Failed to reupload ff_ffect: " << strerror(errno) << std::endl;
-    }
+    // Effects are uploaded to the new controller as they are played, see ff_effect_table::play()
 }
 
 enum phys_ctlr::Model virt_ctlr_combined::needs_model()
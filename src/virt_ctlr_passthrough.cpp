@@ -8,8 +8,9 @@
 //private
 
 //public
-virt_ctlr_passthrough::virt_ctlr_passthrough(std::shared_ptr<phys_ctlr> phys) :
-    phys(phys)
+virt_ctlr_passthrough::virt_ctlr_passthrough(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_manager) :
+    phys(phys),
+    epoll_manager(epoll_manager)
 {
     // Allow other processes to use the input now.
     if (fchmod(phys->get_fd(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH))
@@ -23,7 +24,8 @@ virt_ctlr_passthrough::~virt_ctlr_passthrough()
 
 void virt_ctlr_passthrough::handle_events(int fd)
 {
-    phys->handle_events();
+    if (phys->handle_events())
+        epoll_manager.defer_current();
 }
 
 bool virt_ctlr_passthrough::contains_phys_ctlr(std::shared_ptr<phys_ctlr> const ctlr) const
@@ -12,36 +12,38 @@
 #include <vector>
 
 //private
-void virt_ctlr_pro::relay_events(std::shared_ptr<phys_ctlr> phys)
+// Reads budget events, and then the rest of the frame they end in so that a frame is never split
+// across loop turns; returns how many it read
+unsigned int virt_ctlr_pro::relay_events(std::shared_ptr<phys_ctlr> phys, unsigned int budget)
 {
     struct input_event ev;
-    struct libevdev *evdev = phys->get_evdev();
-
-    int ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-    while (ret == LIBEVDEV_READ_STATUS_SYNC || ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-        if (ret == LIBEVDEV_READ_STATUS_SYNC) {
+    bool syncing = false;
+    bool frame_done = true;
+    unsigned int count;
+
+    for (count = 0; count < budget || !frame_done; count++) {
+        int ret = phys->next_event(ev);
+        if (ret != LIBEVDEV_READ_STATUS_SYNC && ret != LIBEVDEV_READ_STATUS_SUCCESS)
+            break;
+        if (ret == LIBEVDEV_READ_STATUS_SYNC && !syncing)
             std::cout << "handle sync\n";
-            while (ret == LIBEVDEV_READ_STATUS_SYNC) {
-                libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-            }
-        } else if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-#if defined(ANDROID) || defined(__ANDROID__)
-            /* remap the ZL and ZR buttons to analog trigger on android */
-            if (ev.type == EV_KEY && ev.code == BTN_TL2) {
-                libevdev_uinput_write_event(uidev, EV_ABS, ABS_Z, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            } else if (ev.type == EV_KEY && ev.code == BTN_TR2) {
-                libevdev_uinput_write_event(uidev, EV_ABS, ABS_RZ, ev.value);
-                ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-                continue;
-            }
-#endif
-            libevdev_uinput_write_event(uidev, ev.type, ev.code, ev.value);
-        }
-        ret = libevdev_next_event(evdev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+        syncing = ret == LIBEVDEV_READ_STATUS_SYNC;
+        frame_done = ev.type == EV_SYN && ev.code == SYN_REPORT;
+        unsigned int source_type = ev.type;
+        if (remap.apply(ev))
+            frame.add_event(ev, source_type);
     }
+    return count;
+}
+
+// One turn's worth of input; a controller with more than that is continued on the next loop turn
+bool virt_ctlr_pro::relay_turn()
+{
+    unsigned int count = relay_events(phys, phys_ctlr::EVENT_BUDGET);
+
+    if (count >= phys_ctlr::EVENT_BUDGET)
+        epoll_manager.defer_current();
+    return count > 0;
 }
 
 void virt_ctlr_pro::handle_uinput_event()
@@ -52,76 +54,83 @@ void virt_ctlr_pro::handle_uinput_event()
     while ((ret = read(get_uinput_fd(), &ev, sizeof(ev))) == sizeof(ev)) {
         switch (ev.type) {
             case EV_FF:
-                {
-                    struct input_event redirected = ev;
-
-                    if (!rumble_effects.count(ev.code)) {
-                        if (ev.code < FF_GAIN)
-                            std::cerr << "ERROR: ff_effect with id=" << ev.code << " is not in map\n";
-                    } else {
-                        redirected.code = rumble_effects[ev.code].id;
-                    }
-
-                    /* Just forward this FF event on to the actual devices */
-                    if (write(phys->get_fd(), &redirected, sizeof(redirected)) != sizeof(redirected))
-                        std::cerr << "Failed to forward EV_FF to phys\n";
+                /* FF_GAIN and FF_AUTOCENTER aren't effects; forward them as they are */
+                if (ev.code >= FF_GAIN) {
+                    rumble.queue(ev);
                     break;
                 }
 
+                if (ev.value)
+                    ff_counters.plays.add();
+                if (!effects.play(ev, 0, phys->get_fd(), ff_jobs, rumble))
+                    std::cerr << "ERROR: ff_effect with id=" << ev.code << " is not in table\n";
+                break;
+
             case EV_UINPUT:
                 switch (ev.code) {
                     case UI_FF_UPLOAD:
                         {
                             struct uinput_ff_upload upload = { 0 };
-                            struct ff_effect effect = { 0 };
+                            int fd = phys->get_fd();
 
                             upload.request_id = ev.value;
                             if (ioctl(get_uinput_fd(), UI_BEGIN_FF_UPLOAD, &upload))
                                 std::cerr << "Failed to get uinput_ff_upload: " << strerror(errno) << std::endl;
 
-                            effect = upload.effect;
-                            effect.id = -1;
-                            /* upload the effect to the real device */
-                            upload.retval = 0;
-                            if (ioctl(phys->get_fd(), EVIOCSFF, &effect) == -1)
-                                upload.retval = errno;
-
-                            upload.effect = effect;
-
-                            if (upload.retval)
-                                std::cerr << "UI_FF_UPLOAD failed: " << strerror(upload.retval) << std::endl;
-
-                            if (rumble_effects.count(effect.id))
-                                std::cerr << "WARNING: ff_effect already in map\n";
-                            rumble_effects[effect.id] = effect;
-
-                            if (ioctl(get_uinput_fd(), UI_END_FF_UPLOAD, &upload))
-                                std::cerr << "Failed to end uinput_ff_upload: " << strerror(errno) << std::endl;
-
+                            /* upload the effect to the real device, in place if it has it already; the game
+                             * waits until UI_END_FF_UPLOAD */
+                            int16_t phys_id = effects.phys_id(upload.effect.id, 0);
+                            ff_jobs.submit([this, upload, fd, phys_id]() mutable -> ff_pipeline::completion {
+                                struct ff_effect effect = upload.effect;
+
+                                effect.id = phys_id;
+                                upload.retval = 0;
+                                if (ioctl(fd, EVIOCSFF, &effect) == -1)
+                                    upload.retval = errno;
+
+                                return [this, upload, effect]() mutable {
+                                    int16_t ids[ff_effect_table::MAX_SIDES] = { effect.id, ff_effect_table::NOT_UPLOADED };
+
+                                    ff_counters.uploads.add();
+                                    if (upload.retval)
+                                        std::cerr << "UI_FF_UPLOAD failed: " << strerror(upload.retval) << std::endl;
+                                    else
+                                        effects.store(upload.effect.id, upload.effect, ids);
+
+                                    if (ioctl(get_uinput_fd(), UI_END_FF_UPLOAD, &upload))
+                                        std::cerr << "Failed to end uinput_ff_upload: " << strerror(errno) << std::endl;
+                                };
+                            });
                             break;
                         }
                     case UI_FF_ERASE:
                         {
                             struct uinput_ff_erase erase = { 0 };
+                            int fd = phys->get_fd();
 
                             erase.request_id = ev.value;
                             if (ioctl(get_uinput_fd(), UI_BEGIN_FF_ERASE, &erase))
                                 std::cerr << "Failed to get uinput_ff_erase: " << strerror(errno) << std::endl;
 
-                            erase.retval = 0;
-                            if (ioctl(phys->get_fd(), EVIOCRMFF, erase.effect_id) == -1)
-                                erase.retval = errno;
-
-                            if (erase.retval)
-                                std::cerr << "UI_FF_ERASE failed: " << strerror(erase.retval) << std::endl;
-                            else if (!rumble_effects.count(erase.effect_id))
-                                std::cerr << "WARNING: effect_id not in rumble_effects map\n";
-                            else
-                                rumble_effects.erase(erase.effect_id);
-
-                            if (ioctl(get_uinput_fd(), UI_END_FF_ERASE, &erase))
-                                std::cerr << "Failed to end uinput_ff_erase: " << strerror(errno) << std::endl;
-
+                            if (!effects.contains(erase.effect_id))
+                                std::cerr << "WARNING: effect_id not in effect table\n";
+                            int16_t phys_id = effects.phys_id(erase.effect_id, 0);
+                            ff_jobs.submit([this, erase, fd, phys_id]() mutable -> ff_pipeline::completion {
+                                erase.retval = 0;
+                                if (phys_id >= 0 && ioctl(fd, EVIOCRMFF, phys_id) == -1)
+                                    erase.retval = errno;
+
+                                return [this, erase]() mutable {
+                                    ff_counters.erases.add();
+                                    if (erase.retval)
+                                        std::cerr << "UI_FF_ERASE failed: " << strerror(erase.retval) << std::endl;
+                                    else
+                                        effects.erase(erase.effect_id);
+
+                                    if (ioctl(get_uinput_fd(), UI_END_FF_ERASE, &erase))
+                                        std::cerr << "Failed to end uinput_ff_erase: " << strerror(errno) << std::endl;
+                                };
+                            });
                             break;
                         }
                     default:
@@ -148,16 +157,42 @@ void virt_ctlr_pro::handle_uinput_event()
     }
 }
 
+void virt_ctlr_pro::write_metrics(metrics_writer& writer) const
+{
+    std::string labels = metrics_writer::label("ctlr", name) + ",type=\"pro\"";
+
+    frame.write_metrics(writer, labels);
+    writer.counter("joycond_ff_uploads_total", "Force feedback effects uploaded to the virtual controller", labels,
+                   ff_counters.uploads.get());
+    writer.counter("joycond_ff_erases_total", "Force feedback effects erased from the virtual controller", labels,
+                   ff_counters.erases.get());
+    writer.counter("joycond_ff_plays_total", "Force feedback effects started on the virtual controller", labels,
+                   ff_counters.plays.get());
+    rumble.write_metrics(writer, labels);
+}
+
 //public
-virt_ctlr_pro::virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_manager) :
+virt_ctlr_pro::virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_manager, worker_thread& ff_worker,
+                             const remap_profiles& remaps, const joycond_config& config,
+                             metrics_registry& metrics) :
     phys(phys),
     epoll_manager(epoll_manager),
+    remaps(remaps),
     subscriber(nullptr),
     virt_evdev(nullptr),
     uidev(nullptr),
     uifd(-1),
-    rumble_effects(),
-    mac(phys->get_mac_addr())
+    frame(-1, epoll_manager),
+    state(),
+    metrics(metrics),
+    name(),
+    ff_counters(),
+    effects(),
+    rumble(epoll_manager, config.rumble_rate_hz),
+    mac(phys->get_mac_addr()),
+    remap(),
+    busy_poll_ns(remaps.busy_poll_us(*phys, config.busy_poll_us) * 1000ULL),
+    ff_jobs(epoll_manager, ff_worker)
 {
     int ret;
 
@@ -247,6 +282,9 @@ virt_ctlr_pro::virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_m
     libevdev_enable_event_code(virt_evdev, EV_LED, 2, NULL);
     libevdev_enable_event_code(virt_evdev, EV_LED, 3, NULL);
 
+    // Make room for whatever the user's remap profiles map to
+    remaps.enable_targets(virt_evdev, *phys);
+
     ret = libevdev_uinput_create_from_device(virt_evdev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
     if (ret) {
         std::cerr << "Failed to create libevdev_uinput; " << ret << std::endl;
@@ -255,14 +293,32 @@ virt_ctlr_pro::virt_ctlr_pro(std::shared_ptr<phys_ctlr> phys, epoll_mgr& epoll_m
 
     int flags = fcntl(get_uinput_fd(), F_GETFL, 0);
     fcntl(get_uinput_fd(), F_SETFL, flags | O_NONBLOCK);
+    frame.set_uinput_fd(get_uinput_fd());
+    rumble.set_fd(phys->get_fd());
+    frame.set_max_rate(remaps.max_rate_hz(*phys, config.max_rate_hz));
+    const char *devnode = libevdev_uinput_get_devnode(uidev);
+    if (devnode)
+        name = basename(devnode);
+    effects.size_from_device(devnode);
+    if (config.export_state && !name.empty() && state.open(name))
+        frame.set_state_export(&state);
+    metrics.add_source(this, [this](metrics_writer& writer){write_metrics(writer);});
+    remaps.compile(remap, remap_pro, *phys, virt_evdev);
 
     subscriber = std::make_shared<epoll_subscriber>(std::vector({get_uinput_fd()}),
-                                                    [=](int event_fd){handle_events(event_fd);});
+                                                    [=](int event_fd){handle_events(event_fd);},
+                                                    "uinput");
     epoll_manager.add_subscriber(subscriber);
 }
 
 virt_ctlr_pro::~virt_ctlr_pro()
 {
+    metrics.remove_source(this);
+    // Answer outstanding uploads while the uinput device is still there
+    ff_jobs.drain();
+    // A stop still waiting for its slot must not leave the controller rumbling
+    rumble.flush();
+    frame.print_stats();
     epoll_manager.remove_subscriber(subscriber);
 
     libevdev_uinput_destroy(uidev);
@@ -272,12 +328,14 @@ virt_ctlr_pro::~virt_ctlr_pro()
 
 void virt_ctlr_pro::handle_events(int fd)
 {
-    if (fd == phys->get_fd())
-        relay_events(phys);
-    else if (fd == get_uinput_fd())
+    if (fd == phys->get_fd()) {
+        if (relay_turn() && busy_poll_ns)
+            epoll_manager.busy_poll(fd, busy_poll_ns);
+    } else if (fd == get_uinput_fd()) {
         handle_uinput_event();
-    else
+    } else {
         std::cerr << "fd=" << fd << " is an invalid fd for this virtual pro controller\n";
+    }
 }
 
 bool virt_ctlr_pro::contains_phys_ctlr(std::shared_ptr<phys_ctlr> const ctlr) const
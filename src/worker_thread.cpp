@@ -0,0 +1,119 @@
+#include "worker_thread.h"
+#include "realtime.h"
+
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+//private
+void worker_thread::run()
+{
+    // Thread names are limited to 15 characters
+    std::string thread_name = ("joycond-" + name).substr(0, 15);
+    pthread_setname_np(pthread_self(), thread_name.c_str());
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            std::cerr << "Failed to pin " << thread_name << " to cpu " << cpu << std::endl;
+    }
+
+    if (realtime_priority)
+        epoll_manager.set_realtime(realtime_priority, name);
+    else
+        realtime_leave_thread();
+
+    while (running)
+        epoll_manager.loop();
+}
+
+void worker_thread::handle_tasks()
+{
+    std::vector<std::function<void()>> batch;
+    uint64_t count;
+
+    if (read(task_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        std::cerr << "Failed to read task eventfd of " << name << "; " << strerror(errno) << std::endl;
+
+    {
+        std::lock_guard<std::mutex> guard(task_lock);
+        batch.swap(tasks);
+    }
+    for (auto& task : batch)
+        task();
+}
+
+//public
+worker_thread::worker_thread(std::string const &name, int cpu, metrics_registry& metrics,
+                             enum epoll_mgr::Backend backend, int realtime_priority) :
+    name(name),
+    cpu(cpu),
+    realtime_priority(realtime_priority),
+    metrics(metrics),
+    epoll_manager(backend),
+    task_fd(-1),
+    subscriber(nullptr),
+    task_lock(),
+    tasks(),
+    running(true),
+    thread()
+{
+    task_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (task_fd < 0) {
+        std::cerr << "Failed to create task eventfd for " << name << "; " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    subscriber = std::make_shared<epoll_subscriber>(std::vector({task_fd}),
+                                                    [=](int event_fd){handle_tasks();},
+                                                    "tasks");
+    epoll_manager.add_subscriber(subscriber);
+
+    std::string labels = metrics_writer::label("thread", name);
+    metrics.add_source(this, [this, labels](metrics_writer& writer){epoll_manager.write_metrics(writer, labels);});
+
+    thread = std::thread([this](){run();});
+}
+
+worker_thread::~worker_thread()
+{
+    post([this](){running = false;});
+    thread.join();
+
+    metrics.remove_source(this);
+    epoll_manager.remove_subscriber(subscriber);
+    close(task_fd);
+}
+
+void worker_thread::post(std::function<void()> task)
+{
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> guard(task_lock);
+        tasks.push_back(task);
+    }
+    if (write(task_fd, &one, sizeof(one)) != sizeof(one))
+        std::cerr << "Failed to wake " << name << " thread\n";
+}
+
+void worker_thread::run_sync(std::function<void()> task)
+{
+    if (std::this_thread::get_id() == thread.get_id()) {
+        task();
+        return;
+    }
+
+    std::promise<void> done;
+    post([&](){
+        task();
+        done.set_value();
+    });
+    done.get_future().wait();
+}